@@ -5,21 +5,28 @@
  *       The code borrowed some ideas from ARM RL-RTX source code
  */
 
-/* pop off exception stack frame from the stack */
-__asm void __rte(void)
+/* Processes run in thread mode on PSP, exception handlers on MSP.
+ * Where a kernel function entered through SVC 0 returns to, in thread mode */
+__asm void __kernel_return(void)
 {
-  PRESERVE8            ; 8 bytes alignement of the stack
-  MVN  LR, #:NOT:0xFFFFFFF9  ; set EXC_RETURN value, Thread mode, MSP
-  CPSIE I
-  BX   LR
+  CPSIE I              ; SVC cannot be taken with interrupts disabled
+  SVC  1               ; hand the return value in R0 to the caller
 }
 
-/* NOTE: assuming MSP is used. Ideally, PSP should be used */
+/* A kernel call does not run in the handler. SVC 0 stacks a second exception
+ * stack frame below the caller's, so returning from the exception enters the
+ * C kernel function in thread mode on the caller's own stack, with interrupts
+ * still disabled. The kernel function can then block by letting PendSV switch
+ * processes, and carries on once the process runs again. SVC 1 drops that
+ * frame again when the kernel function returns */
 __asm void SVC_Handler (void)
 {
   PRESERVE8            ; 8 bytes alignement of the stack
   CPSID I
-  MRS  R0, MSP         ; Read MSP
+  TST  LR, #4          ; EXC_RETURN bit 2 tells which stack the caller used,
+  ITE  EQ              ; MSP only for rtx_init
+  MRSEQ R0, MSP
+  MRSNE R0, PSP
 
 
   LDR  R1, [R0, #24]   ; Read Saved PC from SP
@@ -31,23 +38,73 @@ __asm void SVC_Handler (void)
   BICS R1, R1, #0xFF00 ; Extract SVC Number and save it in R1.
                        ; R1 <= R1 & ~(0xFF00), update flags
 
-  BNE  SVC_EXIT        ; if SVC Number !=0, exit
+  BNE  SVC_RETURN      ; if SVC Number !=0, the kernel function returned
 
-  LDM  R0, {R0-R3, R12}; Read R0-R3, R12 from stack.
-                       ; NOTE R0 contains the sp before this instruction
+  SUB  R2, R0, #32     ; frame of the kernel function, 8 bytes aligned like R0
+  LDR  R1, [R0]        ; R0-R3 contains the kernel function input parameter
+  STR  R1, [R2]        ; (See AAPCS)
+  LDR  R1, [R0, #4]
+  STR  R1, [R2, #4]
+  LDR  R1, [R0, #8]
+  STR  R1, [R2, #8]
+  LDR  R1, [R0, #12]
+  STR  R1, [R2, #12]
+  LDR  R1, =__cpp(__kernel_return)
+  STR  R1, [R2, #20]   ; LR, the kernel function returns to __kernel_return
+  LDR  R1, [R0, #16]   ; R12 contains the corresponding
+  BIC  R1, R1, #1      ; C kernel functions entry point
+  STR  R1, [R2, #24]   ; PC
+  MOV  R1, #0x01000000 ; Thumb state
+  STR  R1, [R2, #28]   ; xPSR
+  B    SVC_EXIT
+
+SVC_RETURN
+  ADD  R2, R0, #32     ; the caller's frame is right above __kernel_return's
+  LDR  R1, [R0]
+  STR  R1, [R2]        ; store C kernel function return value in R0
+                       ; to R0 on the caller's exception stack frame
+  CPSIE I
 
-  PUSH {R4-R11, LR}    ; Save other registers for preemption caused by i-procs
-  BLX  R12             ; Call SVC C Function,
-                       ; R12 contains the corresponding
-                       ; C kernel functions entry point
-                       ; R0-R3 contains the kernel function input parameter (See AAPCS)
-  POP {R4-R11, LR}     ; Restore other registers for preemption caused by i-procs
-  MRS  R12, MSP        ; Read MSP
-  STR  R0, [R12]       ; store C kernel function return value in R0
-                       ; to R0 on the exception stack frame
 SVC_EXIT
+  TST  LR, #4
+  ITE  EQ
+  MSREQ MSP, R2
+  MSRNE PSP, R2
+  BX   LR
+}
+
+/* Context switch, see k_release_processor and k_request_reschedule. PendSV
+ * has the lowest priority, so it only runs once no other exception is active
+ * and always returns to thread mode. R4-R11 are saved on the process stack
+ * below the exception stack frame, and restored from the new process's */
+__asm void PendSV_Handler(void)
+{
+  PRESERVE8
+  IMPORT c_PendSV_Handler
+  CPSID I
+  MRS  R0, PSP
+  TST  LR, #4          ; still on MSP while starting up, nothing to save
+  IT   NE
+  STMDBNE R0!, {R4-R11}
+  MSR  PSP, R0
+
+  PUSH {R4, LR}        ; R4 keeps MSP 8 bytes aligned
+  BL   c_PendSV_Handler
+  POP  {R4, LR}
+
+  MRS  R0, PSP         ; gp_current_process's stack
+  LDMIA R0!, {R4-R11}
+  MSR  PSP, R0
+
+  TST  LR, #4
+  BNE  PENDSV_EXIT
+  LDR  R0, =0xE000ED08 ; first switch: start the MSP over as the kernel stack,
+  LDR  R0, [R0]        ; from the initial SP in the vector table
+  LDR  R0, [R0]
+  MSR  MSP, R0
+  MVN  LR, #:NOT:0xFFFFFFFD  ; set EXC_RETURN value, Thread mode, PSP
 
-  MVN  LR, #:NOT:0xFFFFFFF9  ; set EXC_RETURN value, Thread mode, MSP
+PENDSV_EXIT
   CPSIE I
   BX   LR
 }
@@ -8,7 +8,19 @@
 #define RTX_ERR -1
 #define RTX_OK 0
 
-#define NUM_PROCS 16
+/* Number of processes with a fixed, well-known PID (see Process IDs below) */
+#define NUM_FIXED_PROCS 16
+
+/* Size of the process table. May be raised at build time, e.g. -DNUM_PROCS=128.
+ * Slots above the fixed PIDs are handed out at runtime by k_alloc_pid() */
+#ifndef NUM_PROCS
+    #define NUM_PROCS 32
+#endif
+
+#if NUM_PROCS < NUM_FIXED_PROCS
+    #error "NUM_PROCS must be at least NUM_FIXED_PROCS"
+#endif
+
 #define NUM_TEST_PROCS 6
 #define NUM_PRIORITIES 5
 
@@ -44,6 +56,9 @@
 #define STATE_RUN             2
 #define STATE_BLOCKED_MEMORY  3
 #define STATE_BLOCKED_MSG     4
+#define STATE_EXITED          5
+#define STATE_BLOCKED_SEND    6
+#define STATE_SLEEP           7
 
 /* Message Types */
 #define DEFAULT 0
@@ -52,6 +67,17 @@
 #define COUNT_REPORT 3
 #define WAKEUP_10 4
 
+/* Priority of a message sent without send_message_priority */
+#define MSG_PRIORITY_DEFAULT LOWEST
+
+/* Publish/subscribe topics */
+#define NUM_TOPICS 8         // most topics with subscribers at once
+#define TOPIC_NAME_LEN 8     // longest topic name, including the terminating 0
+
+/* Wildcards for receive_message_match */
+#define ANY_PID -1
+#define ANY_TYPE -1
+
 /* Types */
 typedef unsigned char U8;
 typedef unsigned int U32;
@@ -70,7 +96,7 @@ typedef struct msgbuf {
     void* mp_next;               // pointer to next message in queue
     int m_send_pid;              // sender pid
     int m_recv_pid;              // receiver pid
-    int m_kdata[4];              // extra 16B kernel data place holder
+    int m_kdata[4];              // extra 16B kernel data place holder, see k_rtx.h
     int m_expiry;                // expiry time in milliseconds
 #endif
     int mtype;                   // user defined message type
@@ -80,12 +106,34 @@ typedef struct msgbuf {
 /* Process Control Block */
 typedef struct pcb {
     struct pcb* mp_next;
+    struct pcb* mp_prev;         // previous process in the same queue
+    struct pq* mp_queue;         // queue the process is on, NULL if none
     U32* mp_sp;                  // stack pointer of the process
     U32 m_pid;                   // process id
     U32 m_state;                 // state of the process
-    U8 m_priority;               // process priority
+    U8 m_priority;               // process priority, raised above m_base_priority while inheriting
+    U8 m_base_priority;          // priority set through set_process_priority
+    U8 m_inherit;                // 1 if the process inherits the priority of its senders
+    U8 m_mem_class;              // memory block size class the process is blocked on
+    void* mp_mem_blk;            // memory block handed over while blocked on memory
+    U32* mp_stack;               // top (high address) of the process stack
+    U32 m_stack_size;            // size of the process stack in bytes
+    struct pcb* mp_timeout_next; // next process in the timed wait list
+    U32 m_timeout;               // g_timer value at which a timed wait gives up
     MSG_BUF* mp_msg_queue_front; // the first element of the message queue
     MSG_BUF* mp_msg_queue_back;  // the last element of the message queue
+    int m_match_pid;             // sender a process blocked on receive waits for, or ANY_PID
+    int m_match_type;            // mtype a process blocked on receive waits for, or ANY_TYPE
+    int m_msg_count;             // number of messages in the message queue
+    int m_msg_capacity;          // most messages other processes may queue, 0 if unbounded
+    int m_send_target;           // process a process blocked on send waits to send to
+    U32 m_slice_end;             // time at which the current time slice runs out
+    U8 m_in_slice;               // 1 if the process has a time slice under way
+    U32 m_period;                // EDF period and relative deadline in ms, 0 for a static priority
+    U32 m_deadline;              // absolute deadline of the current EDF job
+    U32 m_deadline_misses;       // EDF jobs still unfinished at their deadline
+    U8 m_deadline_missed;        // 1 if the miss of the current job is already counted
+    struct pcb* mp_deadline_next; // next EDF process in the deadline list, see arm_deadline
 } PCB;
 
 #endif // COMMON_H
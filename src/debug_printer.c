@@ -1,14 +1,20 @@
 #include "debug_printer.h"
 #include "utils.h"
 #include "pq.h"
+#include "k_memory.h"
 
 extern PROC_INIT g_proc_table[NUM_PROCS];
 extern PCB** gp_pcbs;
 extern PQ g_ready_pq;
-extern PQ g_blocked_pq;
+extern PQ g_edf_ready_pq;
+extern U32 g_deadline_misses;
+extern PQ g_blocked_pq[NUM_BLOCK_CLASSES];
+extern MEM_POOL g_mem_pools[NUM_BLOCK_CLASSES];
+extern PQ g_msg_blocked_pq;
+extern PQ g_send_blocked_pq;
 
 const char* const PRIORITY_NAMES[] = { "HIGH", "MEDIUM", "LOW", "LOWEST", "NULL" };
-const char* const STATE_NAMES[] = { "NEW", "READY", "RUN", "MEM", "MSG" };
+const char* const STATE_NAMES[] = { "NEW", "READY", "RUN", "MEM", "MSG", "EXIT", "SEND", "SLEEP" };
 
 // Prints a priority queue
 void print_queue(PQ* q) {
@@ -32,6 +38,25 @@ void print_ready_procs() {
     print_queue(&g_ready_pq);
 }
 
+void print_edf_procs() {
+    int i;
+
+    logln("EDF Processes (period, deadline, misses)");
+    logln("----------------------------------------");
+
+    for (i = 0; i < NUM_PROCS; i++) {
+        PCB* proc = gp_pcbs[i];
+
+        if (g_proc_table[i].m_pid == -1 || proc->m_period == 0) continue;
+
+        logln("\t%d\t%d\t%d\t%d\t%s", i, proc->m_period, proc->m_deadline, proc->m_deadline_misses, STATE_NAMES[proc->m_state]);
+    }
+    logln("%d deadline misses in total", g_deadline_misses);
+
+    logln("Ready:");
+    print_queue(&g_edf_ready_pq);
+}
+
 void print_all_procs() {
     int i;
     logln("All Processes");
@@ -40,6 +65,9 @@ void print_all_procs() {
     for (i = 0; i < NUM_PROCS; i++) {
         PCB* proc = gp_pcbs[i];
 
+        // skip unused process table slots
+        if (g_proc_table[i].m_pid == -1) continue;
+
         if (proc->m_priority == INTERRUPT) {
             logln("\t%d\tINTER\t%s", i, STATE_NAMES[proc->m_state]);
         } else {
@@ -49,28 +77,25 @@ void print_all_procs() {
 }
 
 void print_memory_blocked_procs() {
+    int i;
+
     logln("Processes blocked on memory");
     logln("---------------------------");
 
-    print_queue(&g_blocked_pq);
+    for (i = 0; i < NUM_BLOCK_CLASSES; i++) {
+        logln("%dB blocks", g_mem_pools[i].m_block_size);
+        print_queue(&g_blocked_pq[i]);
+    }
 }
 
 void print_message_blocked_procs() {
-    int i;
-    PROC_INIT current;
-    PCB* currentPCB;
-
     logln("Processes blocked on receive");
     logln("----------------------------");
 
-    for (i = 0; i < NUM_PROCS; i++) {
-        current = g_proc_table[i];
-        if (current.m_pid == -1) continue;
+    print_queue(&g_msg_blocked_pq);
 
-        currentPCB = gp_pcbs[current.m_pid];
+    logln("Processes blocked on send");
+    logln("-------------------------");
 
-        if (currentPCB->m_state == STATE_BLOCKED_MSG) {
-            logln("\t%d (%s)", current.m_pid, PRIORITY_NAMES[current.m_priority]);
-        }
-    }
+    print_queue(&g_send_blocked_pq);
 }
@@ -3,6 +3,7 @@
 
 void print_ready_procs(void);
 void print_all_procs(void);
+void print_edf_procs(void);
 void print_message_blocked_procs(void);
 void print_memory_blocked_procs(void);
 
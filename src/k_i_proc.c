@@ -1,6 +1,5 @@
 #include "k_i_proc.h"
 #include <LPC17xx.h>
-#include <string.h>
 #include "uart.h"
 #include "uart_polling.h"
 #include "k_memory.h"
@@ -8,21 +7,27 @@
 #include "utils.h"
 
 extern int k_release_processor(void);
+extern int k_bind_irq(int irq, int pid, int priority);
 extern int k_send_message(int, MSG_BUF*);
 extern int k_send_message_internal(int, MSG_BUF*);
-extern void* k_request_memory_block(void);
+extern void k_expire_timeouts(void);
+extern U32 k_check_deadlines(U32 next);
 extern int k_release_memory_block(void*);
 extern MSG_BUF* dequeue_message(PCB*);
-extern void remove_message_delayed(MSG_BUF* message);
+extern void advance_timer_wheel(U32);
+extern U32 next_message_expiry(void);
+extern U32 k_get_time(void);
+extern void k_timer_wakeup_at(U32);
 
 extern PROC_INIT g_proc_table[NUM_PROCS];
 extern PCB** gp_pcbs;
 
 extern U32 g_timer;
-extern MSG_BUF* timeout_queue_front;
+extern PCB* gp_timeout_front;
 
 // UART interrupt globals
 uint8_t g_char_in;
+U32 g_uart_dropped_chars = 0; // keystrokes dropped because the heap was empty
 
 void set_i_procs() {
     /* timer interrupt process */
@@ -36,63 +41,55 @@ void set_i_procs() {
     g_proc_table[PID_UART_IPROC].m_priority = INTERRUPT;
     g_proc_table[PID_UART_IPROC].m_stack_size = 0x100;
     g_proc_table[PID_UART_IPROC].mpf_start_pc = &uart_i_process;
-}
-
-__asm push_registers() {
-    PUSH{r4 - r11}
-    BX LR
-}
 
-__asm pop_registers() {
-    POP{r4 - r11}
-    BX LR
+    // the timer goes first when both interrupts are raised
+    k_bind_irq(TIMER0_IRQn, PID_TIMER_IPROC, 0);
+    k_bind_irq(UART0_IRQn, PID_UART_IPROC, 1);
 }
 
-// gets called once every millisecond
+// gets called at the earliest pending deadline, see k_timer_wakeup_at
 void timer_i_process() {
-    MSG_BUF* message;
-
     while (1) {
-        LPC_TIM0->IR = BIT(0);
+        U32 next;
 
-        g_timer++;
+        LPC_TIM0->IR = BIT(0);
 
-        message = timeout_queue_front;
+        advance_timer_wheel(k_get_time());
+        k_expire_timeouts();
 
-        while (message != NULL) {
-            if (message->m_expiry <= g_timer) {
-                remove_message_delayed(message);
-                k_send_message_internal(message->m_recv_pid, message);
-                message = message->mp_next;
-            } else {
-                break;
-            }
+        // sleep until the next delayed message, timed wait or EDF deadline is due
+        next = next_message_expiry();
+        if (gp_timeout_front != NULL && (int)(gp_timeout_front->m_timeout - next) < 0) {
+            next = gp_timeout_front->m_timeout;
         }
+        next = k_check_deadlines(next);
+        k_timer_wakeup_at(next);
 
-        push_registers();
         k_release_processor();
-        pop_registers();
     }
 }
 
+/* Number of characters a message can hold in its memory block */
+int mtext_capacity(MSG_BUF* msg) {
+    return k_block_size(msg) - (msg->mtext - (char*)msg);
+}
+
 // gets called on input and output
 void uart_i_process() {
     PCB* uart_pcb = gp_pcbs[PID_UART_IPROC];
-    char buffer[MEMORY_BLOCK_SIZE - 2 - sizeof(int)];
-    int isBufferFull = 0;
+    MSG_BUF* out = NULL; // message being transmitted, sent straight from its block
+    int out_len = 0;     // mtext_capacity of out
     int i = 0;
 
     while (1) {
         uint8_t IIR_IntId; // Interrupt ID from IIR
         LPC_UART_TypeDef* pUart = (LPC_UART_TypeDef*) LPC_UART0;
 
-        if (!isBufferFull && uart_pcb->mp_msg_queue_front != NULL) {
+        if (out == NULL && uart_pcb->mp_msg_queue_front != NULL) {
             // Can get new message
-            MSG_BUF* msg = dequeue_message(uart_pcb);
-            strcpy(buffer, msg->mtext);
-            isBufferFull = 1;
+            out = dequeue_message(uart_pcb);
+            out_len = mtext_capacity(out);
             i = 0;
-            k_release_memory_block(msg);
             pUart->IER |= IER_THRE; // enable whatever THRE is
         }
 
@@ -112,9 +109,12 @@ void uart_i_process() {
                 print_memory_blocked_procs();
             } else if (g_char_in == 's') {
                 print_message_blocked_procs();
+            } else if (g_char_in == 'd') {
+                print_edf_procs();
             }
 #endif
-            ptr = (MSG_BUF*) k_request_memory_block();
+            // a keystroke only needs the smallest block size, and must not stall the interrupt
+            ptr = (MSG_BUF*) k_request_memory_block_timed(sizeof(MSG_BUF) + 1, NO_WAIT);
 
             if (ptr != NULL) {
                 ptr->mtype = DEFAULT;
@@ -122,38 +122,36 @@ void uart_i_process() {
                 ptr->mtext[1] = '\0';
                 k_send_message(PID_KCD, ptr);
             } else {
-                logln("Out of memory in uart_i_process");
+                g_uart_dropped_chars++;
+                logln("Out of memory in uart_i_process, %d keystrokes dropped", g_uart_dropped_chars);
             }
         } else if (IIR_IntId & IIR_THRE) {
             /* THRE Interrupt, transmit holding register becomes empty */
-            if (isBufferFull) {
-                if (buffer[i] == '\0') {
+            if (out != NULL) {
+                if (i == out_len || out->mtext[i] == '\0') {
+                    k_release_memory_block(out);
+                    out = NULL;
+
                     if (uart_pcb->mp_msg_queue_front != NULL) {
                         // Can get new message
-                        MSG_BUF* msg = dequeue_message(uart_pcb);
-                        strcpy(buffer, msg->mtext);
-                        isBufferFull = 1;
-                        k_release_memory_block(msg);
+                        out = dequeue_message(uart_pcb);
+                        out_len = mtext_capacity(out);
                     } else {
-                        isBufferFull = 0;
                         pUart->IER &= ~IER_THRE; // toggle the IER_THRE bit
                     }
 
                     i = 0;
                     pUart->THR = '\0';
                 } else {
-                    pUart->THR = buffer[i];
+                    pUart->THR = out->mtext[i];
                     i++;
                 }
             }
         } else {
-            /* not implemented yet */
-            logln("Should not get here!");
-            return;
+            // nothing pending, e.g. the interrupt was latched again while masked.
+            // An i-process must never return, so just wait for the next one
         }
 
-        push_registers();
         k_release_processor();
-        pop_registers();
     }
 }
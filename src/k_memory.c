@@ -7,29 +7,128 @@
  * The first stack starts at the RAM high address
  * stack grows down. Fully decremental stack */
 U32* gp_stack;
-U32* gp_heap_head; // points to the first free memory block in our heap linked list
+U8* gp_heap_start; // first address of the heap, past the PCBs
+U8* gp_heap_end;   // first address past the last heap block
+U8* gp_block_shares; // extra holders of each block by k_block_index, see k_share_block
+
+/* Block pools, smallest block size first. A keystroke message fits in the
+ * smallest class; the kernel message header alone takes 36 bytes. The heap is
+ * split between the pools in proportion to their weights */
+MEM_POOL g_mem_pools[NUM_BLOCK_CLASSES] = {
+    { 64,                6 },
+    { MEMORY_BLOCK_SIZE, 4 },
+    { 512,               1 }
+};
+
+/* A stack given back by an exited process. The node is stored at the bottom of
+ * the freed stack itself */
+typedef struct free_stack {
+    struct free_stack* mp_next;
+    U32* mp_top;                 // top of the stack, as returned by alloc_stack
+    U32 m_size_b;                // stack size in bytes
+} FREE_STACK;
+
+FREE_STACK* gp_free_stacks = NULL; // stacks available for reuse
 
 extern PCB* gp_current_process;
+extern U32 g_timer;
+extern U32 k_get_time(void);
 extern int k_release_processor(void);
+extern void k_request_reschedule(void);
+extern void k_add_timeout(PCB*, U32);
+extern void k_remove_timeout(PCB*);
 extern void pq_push_ready(PCB*);
-extern PCB* pq_pop_blocked(void);
+extern PCB* pq_pop_blocked(int mem_class);
+extern int k_outranks(PCB*, PCB*);
 extern void pq_push_blocked(PCB*);
+extern int rearm_periodic_message(MSG_BUF*);
 
 #ifdef DEBUG_0
     // keep track of how many memory blocks have been allocated for debugging
     int count = 1;
 #endif
 
+/* smallest size class whose blocks hold size_b bytes, or -1 if none */
+int mem_class_of_size(int size_b) {
+    int i;
+    for (i = 0; i < NUM_BLOCK_CLASSES; i++) {
+        if (size_b <= (int)g_mem_pools[i].m_block_size) return i;
+    }
+    return -1;
+}
+
+/* size class of the pool containing a given block, or -1 if it is not a block */
+int mem_class_of_block(void* p_mem_blk) {
+    U8* p = (U8*)p_mem_blk;
+    int i;
+    for (i = 0; i < NUM_BLOCK_CLASSES; i++) {
+        MEM_POOL* pool = &g_mem_pools[i];
+        if (p >= pool->mp_start && p < pool->mp_end) {
+            if ((p - pool->mp_start) % pool->m_block_size != 0) return -1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Every block starts a multiple of the smallest block size past gp_heap_start,
+ * which numbers the blocks across all pools */
+int k_block_index(void* p_mem_blk) {
+    return ((U8*)p_mem_blk - gp_heap_start) / g_mem_pools[0].m_block_size;
+}
+
+/* size in bytes of a given block, or 0 if it is not a block */
+U32 k_block_size(void* p_mem_blk) {
+    int mem_class = mem_class_of_block(p_mem_blk);
+
+    if (mem_class == -1) return 0;
+    return g_mem_pools[mem_class].m_block_size;
+}
+
+/**
+ * Give a block extra holders. The block only goes back to its pool once it
+ * has been released one more time than the number of extra holders.
+ *
+ * @param num_extra number of holders besides the current one, at most 255
+ */
+void k_share_block(void* p_mem_blk, int num_extra) {
+    gp_block_shares[k_block_index(p_mem_blk)] = num_extra;
+}
+
+/* 1 if a block is still held by more than one process, 0 otherwise */
+int k_block_shared(void* p_mem_blk) {
+    if (mem_class_of_block(p_mem_blk) == -1) return 0;
+    return gp_block_shares[k_block_index(p_mem_blk)] > 0;
+}
+
+/* block with a given k_block_index, or NULL if there is none */
+void* k_block_at(int index) {
+    void* p_mem_blk = gp_heap_start + index * g_mem_pools[0].m_block_size;
+
+    if (index < 0 || mem_class_of_block(p_mem_blk) == -1) return NULL;
+    return p_mem_blk;
+}
+
 /*
- * @brief: Initialize RAM as follows:
+ * @brief: Initialize RAM as follows. memory_init lays out the PCBs,
+ *         process_init then allocates the stacks, and heap_init turns the RAM
+ *         left in between into memory blocks:
  *
  * 0x10008000+---------------------------+ High Address
  *           |    Proc 1 STACK           |
  *           |---------------------------|
  *           |    Proc 2 STACK           |
  *           |---------------------------|<--- gp_stack
- *           |        HEAP               |
- *           |---------------------------|<--- p_end
+ *           |   RUNTIME_STACK_RESERVE   |
+ *           |---------------------------|<--- gp_heap_end
+ *           |        512B POOL          |
+ *           |---------------------------|
+ *           |        128B POOL          |
+ *           |---------------------------|
+ *           |        64B POOL           |
+ *           |---------------------------|<--- gp_heap_start
+ *           |    Block share counts     |
+ *           |---------------------------|<--- gp_block_shares
  *           |        PCB 2              |
  *           |---------------------------|
  *           |        PCB 1              |
@@ -46,8 +145,6 @@ extern void pq_push_blocked(PCB*);
 
 void memory_init(void) {
     U8* p_end = (U8*)&Image$$RW_IRAM1$$ZI$$Limit;
-    U32* previous = NULL;
-    U32* current;
     int i;
 
     p_end += 4; // 4 bytes padding
@@ -69,36 +166,85 @@ void memory_init(void) {
         --gp_stack;
     }
 
-    /* allocate memory for heap
-     * p_end points to the bottom of our heap
-     *
-     * Note: Stacks have not been allocated yet, we are assuming that
-     * we won't run into the stack memory */
+    // the heap starts past the PCBs, 16 bytes padding
+    gp_heap_start = p_end + 16;
+}
+
+/**
+ * Split the RAM between the PCBs and the process stacks into memory blocks.
+ * Must run after process_init has allocated the stacks. RUNTIME_STACK_RESERVE
+ * bytes are left below the stacks for processes created at runtime.
+ */
+void heap_init(void) {
+    U32 heap_size = 0;
+    U32 unit_size = 0;
+    U32 num_units;
+    U32 num_slots;
+    U32* previous;
+    U32* current;
+    int i;
+    int j;
+
+    if ((U8*)gp_stack > gp_heap_start + RUNTIME_STACK_RESERVE) {
+        heap_size = (U8*)gp_stack - gp_heap_start - RUNTIME_STACK_RESERVE;
+    } else {
+        logln("heap_init: no RAM left for the heap");
+    }
+
+    // one share count per smallest block the heap could hold, 8 bytes aligned
+    num_slots = (heap_size / g_mem_pools[0].m_block_size + 7) & ~7;
+    gp_block_shares = gp_heap_start;
+    for (i = 0; i < num_slots; i++) {
+        gp_block_shares[i] = 0;
+    }
+    gp_heap_start += num_slots;
+    heap_size -= num_slots;
+
+    // every pool gets m_weight blocks per unit, leftover bytes go to the smallest blocks
+    for (j = 0; j < NUM_BLOCK_CLASSES; j++) {
+        unit_size += g_mem_pools[j].m_weight * g_mem_pools[j].m_block_size;
+    }
+    num_units = heap_size / unit_size;
+    for (j = 0; j < NUM_BLOCK_CLASSES; j++) {
+        g_mem_pools[j].m_num_blocks = g_mem_pools[j].m_weight * num_units;
+    }
+    g_mem_pools[0].m_num_blocks += (heap_size - num_units * unit_size) / g_mem_pools[0].m_block_size;
+
+    current = (U32*)gp_heap_start;
+
+    for (j = 0; j < NUM_BLOCK_CLASSES; j++) {
+        MEM_POOL* pool = &g_mem_pools[j];
+        previous = NULL;
+        pool->mp_start = (U8*)current;
 
-    current = (U32*)p_end + 4; // 4 byte padding
+        for (i = 0; i < pool->m_num_blocks; i++, current = (U32*)((U8*)current + pool->m_block_size)) {
+            // set current block to point to next block
+            *((U32*)current) = (U32)previous;
+            previous = current;
+        }
+        pool->mp_head = previous;
+        pool->mp_end = (U8*)current;
 
-    for (i = 0; i < NUM_MEMORY_BLOCKS; i++, current = (U32*)((U8*)current + MEMORY_BLOCK_SIZE)) {
-        // set current block to point to next block
-        *((U32*)current) = (U32)previous;
-        previous = current;
+        logln("heap_init: %d blocks of %dB", pool->m_num_blocks, pool->m_block_size);
     }
-    gp_heap_head = previous;
+    gp_heap_end = (U8*)current;
 }
 
 /**
-* Allocate stack for a process, align to 8 bytes boundary
+* Allocate stack for a process, align to 8 bytes boundary. Interrupt handlers
+* and the scheduler run on MSP, so besides size_b a process stack only needs
+* room for the context PendSV saves on it.
 *
 * @param size_b stack size in bytes
 * @return the top of the stack (i.e. high address)
 * POST: gp_stack is updated
 */
 U32* alloc_stack(U32 size_b) {
-    U8 numBytesForAllRegisters = 16 * 4; // 16 registers, 4 bytes a piece
     U32* sp;
     sp = gp_stack; // always 8 bytes aligned
 
     // update gp_stack
-    gp_stack = (U32*)((U8*)sp - (size_b + numBytesForAllRegisters));
+    gp_stack = (U32*)((U8*)sp - (size_b + CONTEXT_FRAME_SIZE));
 
     // 8 bytes alignement adjustment to exception stack frame
     if ((U32)gp_stack & 0x04) {
@@ -109,72 +255,264 @@ U32* alloc_stack(U32 size_b) {
 }
 
 /**
- * Gets a pointer to a memory block of size MEMORY_BLOCK_SIZE if there is block
- * available in the heap.
+ * Allocate a stack for a process created at runtime. A stack given back by an
+ * exited process is reused if one is large enough, otherwise a new stack is
+ * carved below the existing ones.
  *
- * @return pointer to this block. NULL if no blocks available
- * POST: gp_stack is updated
+ * @param p_size_b requested stack size in bytes, updated to the actual size
+ * @return the top of the stack, or NULL if out of stack memory
  */
-void* k_request_memory_block(void) {
+U32* k_request_stack(U32* p_size_b) {
+    FREE_STACK** p_link = &gp_free_stacks;
+    U32* old_stack = gp_stack;
+    U32* sp;
+
+    *p_size_b = (*p_size_b + 7) & ~7; // keep the free stack node 8 byte aligned
+
+    // first fit from the stacks of exited processes
+    while (*p_link != NULL) {
+        FREE_STACK* node = *p_link;
+        if (node->m_size_b >= *p_size_b) {
+            *p_link = node->mp_next;
+            *p_size_b = node->m_size_b;
+            return node->mp_top;
+        }
+        p_link = &node->mp_next;
+    }
+
+    sp = alloc_stack(*p_size_b);
+    if ((U8*)gp_stack < gp_heap_end) {
+        // the new stack would run into the heap
+        gp_stack = old_stack;
+        return NULL;
+    }
+
+    return sp;
+}
+
+/**
+ * Give the stack of an exited process back for reuse.
+ *
+ * @param p_stack the top of the stack
+ * @param size_b the stack size in bytes
+ */
+void k_release_stack(U32* p_stack, U32 size_b) {
+    FREE_STACK* node = (FREE_STACK*)((U8*)p_stack - (size_b + CONTEXT_FRAME_SIZE));
+
+    node->mp_top = p_stack;
+    node->m_size_b = size_b;
+    node->mp_next = gp_free_stacks;
+    gp_free_stacks = node;
+}
+
+/* take a block from the smallest non-empty pool of at least the given class */
+void* alloc_block(int mem_class) {
+    U32* block;
+
+    for (; mem_class < NUM_BLOCK_CLASSES; mem_class++) {
+        block = g_mem_pools[mem_class].mp_head;
+        if (block != NULL) {
+            g_mem_pools[mem_class].mp_head = (U32*)(*block);
+            return (void*)block;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Gets a pointer to a memory block of at least size_b bytes. The block comes
+ * from the smallest size class that fits and has a free block. Interrupt
+ * processes never block, they get NULL when out of memory.
+ *
+ * @param size_b size of the block in bytes, including the message header
+ * @param timeout how long to block in ms, NO_WAIT or WAIT_FOREVER
+ * @return pointer to this block. NULL if no size class is large enough or no
+ *         block became free in time
+ */
+void* k_request_memory_block_timed(int size_b, int timeout) {
+    int mem_class = mem_class_of_size(size_b);
+    U32 expiry = k_get_time() + timeout;
     void* returnVal;
 
+    if (mem_class == -1) return NULL;
+
 #ifdef DEBUG_0
     log("k_request_memory_block #%d: entering ...", count);
 #endif
 
     do {
-        returnVal = (void*)gp_heap_head;
-        if (gp_heap_head != NULL) {
-            // making sure we do not deference the HEAD if it is null.
-            gp_heap_head = (U32*)(*gp_heap_head);
-
-#ifdef DEBUG_0
-            logln(" allocated");
-            count++;
-#endif
-        } else {
+        returnVal = alloc_block(mem_class);
+        if (returnVal == NULL) {
             logln("Out of memory, oops");
 
-            if (gp_current_process->m_priority != INTERRUPT) {
-                /* we have no free memory, set current process to STATE_BLOCKED_MEMORY */
-                gp_current_process->m_state = STATE_BLOCKED_MEMORY;
+            if (timeout == NO_WAIT || gp_current_process->m_priority == INTERRUPT) return NULL;
+            if (timeout != WAIT_FOREVER && (int)(k_get_time() - expiry) >= 0) return NULL;
+
+            /* we have no free memory, set current process to STATE_BLOCKED_MEMORY */
+            gp_current_process->m_state = STATE_BLOCKED_MEMORY;
+            gp_current_process->m_mem_class = mem_class;
+            if (timeout != WAIT_FOREVER) {
+                k_add_timeout(gp_current_process, expiry);
             }
 
             k_release_processor();
+
+            if (timeout != WAIT_FOREVER) {
+                k_remove_timeout(gp_current_process);
+            }
+
+            // the releasing process hands its block straight to the process it unblocks
+            returnVal = gp_current_process->mp_mem_blk;
+            gp_current_process->mp_mem_blk = NULL;
         }
     } while (returnVal == NULL);
 
+    // free_block must not take a stale header for a running periodic template
+    MSG_HANDLE((MSG_BUF*)returnVal) = 0;
+
+#ifdef DEBUG_0
+    logln(" allocated");
+    count++;
+#endif
+
     return returnVal;
 }
 
 /**
- * Return a memory block to the heap. If there is a blocked process in the
- * priority queue with a higher priority than the current process, it is
- * preempted.
+ * Gets a pointer to a memory block of at least size_b bytes, blocking until one
+ * is available.
+ *
+ * @param size_b size of the block in bytes, including the message header
+ * @return pointer to this block. NULL if no size class is large enough
+ */
+void* k_request_memory_block_sized(int size_b) {
+    return k_request_memory_block_timed(size_b, WAIT_FOREVER);
+}
+
+/**
+ * Gets a pointer to a memory block of size MEMORY_BLOCK_SIZE, blocking until
+ * one is available.
+ *
+ * @return pointer to this block
+ */
+void* k_request_memory_block(void) {
+    return k_request_memory_block_timed(MEMORY_BLOCK_SIZE, WAIT_FOREVER);
+}
+
+/**
+ * Gets a pointer to a memory block of size MEMORY_BLOCK_SIZE without blocking.
+ *
+ * @return pointer to this block. NULL if no blocks available
+ */
+void* k_try_request_memory_block(void) {
+    return k_request_memory_block_timed(MEMORY_BLOCK_SIZE, NO_WAIT);
+}
+
+/**
+ * Gets a pointer to a memory block of size MEMORY_BLOCK_SIZE, blocking for at
+ * most timeout ms.
+ *
+ * @return pointer to this block. NULL if no block became free in time
+ */
+void* k_request_memory_block_timeout(int timeout) {
+    if (timeout < 0) return NULL;
+
+    return k_request_memory_block_timed(MEMORY_BLOCK_SIZE, timeout);
+}
+
+/**
+ * Return a memory block to its pool, or hand it to the highest priority process
+ * blocked on a size class it can serve. Waiters of the same priority are served
+ * in the order they blocked.
  *
  * @param p_mem_blk pointer to the reclaimed memory block
- * @return 0 on success
+ * @return -1 if p_mem_blk is not a memory block, 1 if the unblocked process
+ *         has a higher priority than the current process, 0 otherwise
  */
-int k_release_memory_block(void* p_mem_blk) {
-    PCB* blocked_proc = pq_pop_blocked();
-    U32* head_value = gp_heap_head;
+int free_block(void* p_mem_blk) {
+    int mem_class = mem_class_of_block(p_mem_blk);
+    PCB* blocked_proc;
+    MEM_POOL* pool;
+
+    if (mem_class == -1) return RTX_ERR;
+
+    // a shared block stays allocated until its last holder releases it
+    if (gp_block_shares[k_block_index(p_mem_blk)] > 0) {
+        gp_block_shares[k_block_index(p_mem_blk)]--;
+        return 0;
+    }
+
+    // a periodic template is not freed but goes back on the timing wheel
+    if (rearm_periodic_message((MSG_BUF*)p_mem_blk)) return 0;
 
 #ifdef DEBUG_0
     logln("k_release_memory_block: releasing block #%d @ 0x%x", --count, p_mem_blk);
 #endif
 
-    gp_heap_head = (U32*)p_mem_blk;
-    *gp_heap_head = (U32)head_value;
-
-    /* preempt the current process if a blocked process has a higher priority */
+    blocked_proc = pq_pop_blocked(mem_class);
     if (blocked_proc != NULL) {
+        blocked_proc->mp_mem_blk = p_mem_blk;
         blocked_proc->m_state = STATE_READY;
         pq_push_ready(blocked_proc);
 
-        if (gp_current_process->m_priority != INTERRUPT) {
-            k_release_processor();
-        }
+        return k_outranks(blocked_proc, gp_current_process);
+    }
+
+    pool = &g_mem_pools[mem_class];
+    *((U32*)p_mem_blk) = (U32)pool->mp_head;
+    pool->mp_head = (U32*)p_mem_blk;
+
+    return 0;
+}
+
+/**
+ * Return a memory block to the heap. The current process is only preempted if
+ * this unblocks a process with a higher priority.
+ *
+ * @param p_mem_blk pointer to the reclaimed memory block
+ * @return 0 on success, -1 if p_mem_blk is not a memory block
+ */
+int k_release_memory_block(void* p_mem_blk) {
+    int preempt = free_block(p_mem_blk);
+
+    if (preempt == RTX_ERR) return RTX_ERR;
+
+    if (preempt) {
+        k_request_reschedule();
     }
 
     return RTX_OK;
 }
+
+/**
+ * Return several memory blocks to the heap, unblocking up to num_blocks
+ * processes with at most one reschedule.
+ *
+ * @param p_mem_blks array of pointers to the reclaimed memory blocks
+ * @param num_blocks number of blocks in p_mem_blks
+ * @return 0 on success, -1 if any pointer is not a memory block. The valid
+ *         blocks are released either way
+ */
+int k_release_memory_blocks(void** p_mem_blks, int num_blocks) {
+    int ret = RTX_OK;
+    int preempt = 0;
+    int i;
+
+    if (p_mem_blks == NULL || num_blocks < 0) return RTX_ERR;
+
+    for (i = 0; i < num_blocks; i++) {
+        int result = free_block(p_mem_blks[i]);
+        if (result == RTX_ERR) {
+            ret = RTX_ERR;
+        } else {
+            preempt |= result;
+        }
+    }
+
+    if (preempt) {
+        k_request_reschedule();
+    }
+
+    return ret;
+}
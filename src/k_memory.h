@@ -5,8 +5,23 @@
 
 /* ----- Definitions ----- */
 #define RAM_END_ADDR 0x10008000
-#define MEMORY_BLOCK_SIZE 128
-#define NUM_MEMORY_BLOCKS 30
+#define MEMORY_BLOCK_SIZE 128 // size of the blocks handed out by request_memory_block
+#define NUM_BLOCK_CLASSES 3   // number of block sizes, see g_mem_pools
+#define RUNTIME_STACK_RESERVE 0x800 // bytes kept free below the stacks for create_process
+#define CONTEXT_FRAME_SIZE (16 * 4) // exception stack frame and R4-R11 of a process switched out
+#define NO_WAIT 0             // timeout of a request that must not block
+#define WAIT_FOREVER -1       // timeout of a request that blocks until it succeeds
+
+/* ----- Types ----- */
+/* A pool of fixed size memory blocks, carved from one contiguous region */
+typedef struct mem_pool {
+    U32 m_block_size;            // size of each block in bytes
+    U32 m_weight;                // share of the heap, in blocks per heap_init unit
+    U32 m_num_blocks;            // number of blocks in the pool
+    U32* mp_head;                // first free block, each free block links to the next
+    U8* mp_start;                // first block of the pool
+    U8* mp_end;                  // first address past the last block
+} MEM_POOL;
 
 /* ----- Variables ----- */
 /* This symbol is defined in the scatter file (see RVCT Linker User Guide) */
@@ -16,8 +31,21 @@ extern PROC_INIT g_proc_table[NUM_PROCS];
 
 /* ----- Functions ------ */
 void memory_init(void);
+void heap_init(void);
 U32* alloc_stack(U32 size_b);
+U32* k_request_stack(U32* p_size_b);
+void k_release_stack(U32* p_stack, U32 size_b);
+int k_block_index(void* p_mem_blk);
+void* k_block_at(int index);
+U32 k_block_size(void* p_mem_blk);
+void k_share_block(void* p_mem_blk, int num_extra);
+int k_block_shared(void* p_mem_blk);
 void* k_request_memory_block(void);
+void* k_request_memory_block_sized(int size_b);
+void* k_request_memory_block_timed(int size_b, int timeout);
+void* k_try_request_memory_block(void);
+void* k_request_memory_block_timeout(int timeout);
 int k_release_memory_block(void* p_mem_blk);
+int k_release_memory_blocks(void** p_mem_blks, int num_blocks);
 
 #endif // K_MEM_H
@@ -1,9 +1,11 @@
 #include <LPC17xx.h>
 #include <system_LPC17xx.h>
 #include "k_process.h"
+#include "k_memory.h"
 #include "uart_polling.h"
 #include "pq.h"
 #include "utils.h"
+#include <string.h>
 
 #ifdef DEBUG_0
     #include "printf.h"
@@ -17,48 +19,233 @@ PCB* gp_current_process = NULL; // always point to the current STATE_RUN process
 PROC_INIT g_proc_table[NUM_PROCS];
 
 /* Process priority queues */
-PQ g_blocked_pq;
+PQ g_blocked_pq[NUM_BLOCK_CLASSES]; // one queue per memory block size class
+PQ g_msg_blocked_pq;
+PQ g_send_blocked_pq;  // processes waiting for room in a full mailbox
 PQ g_ready_pq;
+PQ g_edf_ready_pq;     // ready EDF processes at HIGH, earliest deadline first
+U32 g_deadline_misses = 0; // EDF jobs still unfinished at their deadline, over all processes
+
+/* Time slice in ms of the processes at each priority, 0 for none. Peers at the
+ * same priority take turns once a slice runs out */
+U32 g_quantum[NUM_PRIORITIES] = { DEFAULT_QUANTUM, DEFAULT_QUANTUM, DEFAULT_QUANTUM, DEFAULT_QUANTUM, 0 };
+
+/* Processes in a timed wait, earliest timeout first */
+PCB* gp_timeout_front = NULL;
+
+/* EDF processes whose current deadline has not been missed yet, earliest first */
+PCB* gp_deadline_front = NULL;
+
+/* Queue of process table slots not claimed by a fixed PID. The slot freed
+ * longest ago is handed out first, so a process id is reused as late as possible */
+int g_free_pids[NUM_PROCS];
+int g_free_pids_front = 0;
+int g_num_free_pids = 0;
+U32 g_pid_generation[NUM_PROCS]; // bumped each time a process id is freed
+
+/* Publish/subscribe topics and the spare queue entries for publishing */
+TOPIC g_topics[NUM_TOPICS];
+MSG_REF g_msg_refs[NUM_MSG_REFS];
+MSG_REF* gp_free_msg_refs = NULL;
+int g_num_free_msg_refs = 0;
+
+/* Interrupts bound to interrupt processes, see k_bind_irq. Each owns a bit of
+ * the pending words, and __clz finds the one to dispatch first */
+U32 g_irq_bit[NUM_IRQS];             // pending bit of each interrupt, 0 if unbound
+int g_irq_slot_pid[NUM_IRQ_SLOTS];   // interrupt process dispatched for each bit
+int g_irq_slot_irq[NUM_IRQ_SLOTS];   // interrupt that owns each bit
+U32 g_irq_bound = 0;                 // bits owned by an interrupt
+volatile U32 g_irq_pending = 0;      // raised by interrupt handlers
+U32 g_irq_batch = 0;                 // raised bits still to dispatch, see next_irq_process
+int g_irq_current = -1;              // bit of the running interrupt process, -1 if none
+volatile int g_reschedule_pending = 0; // a deferred switch is waiting on PendSV
+PCB* gp_handoff_process = NULL;         // runs next without going through the ready queue
+
+extern U32 g_timer;
+extern U32 k_get_time(void);
+extern void k_timer_wakeup_at(U32);
+extern int insert_message_delayed(PCB*, MSG_BUF*, int);
+extern MSG_BUF* find_message_delayed(int);
+extern void remove_message_delayed(MSG_BUF*);
+extern void remove_messages_delayed_to(int);
+extern int message_on_wheel(MSG_BUF*);
+extern PROC_INIT g_test_procs[NUM_TEST_PROCS];
 
-volatile int timer_i_proc_pending = 0;
-volatile int uart_i_proc_pending = 0;
+void start_slice(PCB* proc);
+int k_irq_pending(void);
+PCB* next_irq_process(void);
 
-extern void insert_message_delayed(PCB*, MSG_BUF*, int);
-extern PROC_INIT g_test_procs[NUM_TEST_PROCS];
+/* Queue a ready EDF process behind the ones with an earlier or equal deadline */
+void pq_push_edf(PCB* proc) {
+    PCB* next = g_edf_ready_pq.front[proc->m_priority];
+
+    while (next != NULL && (int)(next->m_deadline - proc->m_deadline) <= 0) {
+        next = next->mp_next;
+    }
+    pq_push_before(&g_edf_ready_pq, proc, next);
+}
 
 /* Priority queue convenience functions, useful for external calls */
 void pq_push_ready(PCB* proc) {
+    if (proc->m_period != 0) {
+        pq_push_edf(proc);
+        return;
+    }
+
     pq_push(&g_ready_pq, proc);
+
+    // a new peer bounds how long the running process keeps the processor
+    if (gp_current_process != NULL && proc != gp_current_process && proc->m_priority == gp_current_process->m_priority) {
+        start_slice(gp_current_process);
+    }
 }
 
 void pq_push_ready_front(PCB* proc) {
+    if (proc->m_period != 0) {
+        pq_push_edf(proc);
+        return;
+    }
+
     pq_push_front(&g_ready_pq, proc);
 }
 
 void pq_push_blocked(PCB* proc) {
-    pq_push(&g_blocked_pq, proc);
+    pq_push(&g_blocked_pq[proc->m_mem_class], proc);
 }
 
+/* EDF processes run ahead of every static priority */
 PCB* pq_pop_ready() {
-    return pq_pop(&g_ready_pq);
+    PCB* proc = pq_pop(&g_edf_ready_pq);
+
+    if (proc == NULL) {
+        proc = pq_pop(&g_ready_pq);
+    }
+    return proc;
+}
+
+/**
+ * 1 if process a should run before process b, 0 otherwise. EDF processes come
+ * before every static priority, earliest deadline first.
+ */
+int k_outranks(PCB* a, PCB* b) {
+    if (a->m_period != 0 && b->m_period != 0) {
+        return (int)(a->m_deadline - b->m_deadline) < 0;
+    }
+    if (a->m_period != 0 || b->m_period != 0) {
+        return a->m_period != 0;
+    }
+    return a->m_priority < b->m_priority;
+}
+
+/* 1 if some ready process should run before proc, 0 otherwise */
+int ready_outranks(PCB* proc) {
+    PCB* edf = g_edf_ready_pq.front[HIGH];
+
+    if (edf != NULL) {
+        return k_outranks(edf, proc);
+    }
+    return proc->m_period == 0 && pq_top_priority(&g_ready_pq) < proc->m_priority;
+}
+
+/* pop the highest priority process blocked on mem_class or a smaller class,
+ * preferring the larger class on a tie */
+PCB* pq_pop_blocked(int mem_class) {
+    int best = -1;
+    int i;
+
+    for (i = mem_class; i >= 0; i--) {
+        if (best == -1 || pq_top_priority(&g_blocked_pq[i]) < pq_top_priority(&g_blocked_pq[best])) {
+            best = i;
+        }
+    }
+
+    return pq_pop(&g_blocked_pq[best]);
 }
 
-PCB* pq_pop_blocked() {
-    return pq_pop(&g_blocked_pq);
+/**
+ * Claim an unused slot of the process table.
+ *
+ * @return a free process id, or -1 if the table is full
+ */
+int k_alloc_pid(void) {
+    int pid;
+
+    if (g_num_free_pids == 0) return RTX_ERR;
+
+    pid = g_free_pids[g_free_pids_front];
+    g_free_pids_front = (g_free_pids_front + 1) % NUM_PROCS;
+    g_num_free_pids--;
+    return pid;
 }
 
-PCB* pq_pop_PCB_ready(const PCB* proc) {
-    return pq_pop_PCB(&g_ready_pq, proc);
+/* Mark a process table slot unused. Only slots claimed by k_alloc_pid are
+ * handed out again, a fixed PID keeps meaning its own process */
+void k_free_pid(int pid) {
+    g_proc_table[pid].m_pid = -1;
+    g_pid_generation[pid]++;
+    if (pid >= NUM_FIXED_PROCS) {
+        g_free_pids[(g_free_pids_front + g_num_free_pids) % NUM_PROCS] = pid;
+        g_num_free_pids++;
+    }
 }
 
-PCB* pq_pop_PCB_blocked(const PCB* proc) {
-    return pq_pop_PCB(&g_blocked_pq, proc);
+/**
+ * Set up the PCB and initial exception stack frame of the process described by
+ * g_proc_table[pid], and queue it if it is not an interrupt process.
+ *
+ * @param sp top of the stack allocated for the process
+ * @param size_b size of that stack in bytes
+ */
+void init_process(int pid, U32* sp, U32 size_b) {
+    PCB* pcb = gp_pcbs[pid];
+    int j;
+
+    pcb->mp_next            = NULL;
+    pcb->mp_prev            = NULL;
+    pcb->mp_queue           = NULL;
+    pcb->m_pid              = g_proc_table[pid].m_pid;
+    pcb->m_priority         = g_proc_table[pid].m_priority;
+    pcb->m_base_priority    = g_proc_table[pid].m_priority;
+    pcb->m_inherit          = 0;
+    pcb->m_state            = STATE_NEW;
+    pcb->m_mem_class        = 0;
+    pcb->mp_mem_blk         = NULL;
+    pcb->mp_msg_queue_front = NULL;
+    pcb->mp_msg_queue_back  = NULL;
+    pcb->m_match_pid        = ANY_PID;
+    pcb->m_match_type       = ANY_TYPE;
+    pcb->m_msg_count        = 0;
+    pcb->m_msg_capacity     = 0;
+    pcb->m_send_target      = -1;
+    pcb->m_slice_end        = 0;
+    pcb->m_in_slice         = 0;
+    pcb->m_period           = 0;
+    pcb->m_deadline         = 0;
+    pcb->m_deadline_misses  = 0;
+    pcb->m_deadline_missed  = 0;
+    pcb->mp_deadline_next   = NULL;
+    pcb->mp_stack           = sp;
+    pcb->m_stack_size       = size_b;
+    pcb->mp_timeout_next    = NULL;
+    pcb->m_timeout          = 0;
+
+    // the context frame PendSV restores: exception stack frame, then R4-R11
+    *(--sp) = INITIAL_xPSR; // user process initial xPSR
+    *(--sp) = (U32)(g_proc_table[pid].mpf_start_pc); // PC contains the entry point of the process
+    for (j = 0; j < 6 + 8; j++) { // LR, R12, R0-R3 and R4-R11 are cleared with 0
+        *(--sp) = 0x0;
+    }
+    pcb->mp_sp = sp;
+
+    // only push non-interrupt processes onto the ready queue
+    if (pcb->m_priority != INTERRUPT) {
+        pq_push_ready(pcb);
+    }
 }
 
 /* Initialize all processes in the system */
 void process_init() {
     int i;
-    U32* sp;
 
     // fill out the initialization table
     for (i = 0; i < NUM_PROCS; i++) {
@@ -75,198 +262,247 @@ void process_init() {
     }
 
     // initialize priority queues
-    for (i = 0; i < NUM_PRIORITIES; i++) {
-        g_blocked_pq.front[i] = NULL;
-        g_blocked_pq.back[i]  = NULL;
-        g_ready_pq.front[i]   = NULL;
-        g_ready_pq.back[i]    = NULL;
+    for (i = 0; i < NUM_BLOCK_CLASSES; i++) {
+        pq_init(&g_blocked_pq[i]);
+    }
+    pq_init(&g_msg_blocked_pq);
+    pq_init(&g_send_blocked_pq);
+    pq_init(&g_ready_pq);
+    pq_init(&g_edf_ready_pq);
+
+    // chain the spare queue entries for k_publish
+    for (i = 0; i < NUM_MSG_REFS; i++) {
+        g_msg_refs[i].m_env.mp_next = gp_free_msg_refs;
+        gp_free_msg_refs = &g_msg_refs[i];
     }
+    g_num_free_msg_refs = NUM_MSG_REFS;
 
     // initilize exception stack frame (i.e. initial context) for each process
     for (i = 0; i < NUM_PROCS; i++) {
-        int j;
-
-        // skip if this process is not being used
-        if (g_proc_table[i].m_pid == -1) continue;
-
-        (gp_pcbs[i])->mp_next            = NULL;
-        (gp_pcbs[i])->m_pid              = g_proc_table[i].m_pid;
-        (gp_pcbs[i])->m_priority         = g_proc_table[i].m_priority;
-        (gp_pcbs[i])->m_state            = STATE_NEW;
-        (gp_pcbs[i])->mp_msg_queue_front = NULL;
-        (gp_pcbs[i])->mp_msg_queue_back  = NULL;
-
-        sp = alloc_stack(g_proc_table[i].m_stack_size);
-        *(--sp) = INITIAL_xPSR; // user process initial xPSR
-        *(--sp) = (U32)(g_proc_table[i].mpf_start_pc); // PC contains the entry point of the process
-        for (j = 0; j < 6; j++) { // R0-R3, R12 are cleared with 0
-            *(--sp) = 0x0;
+        // unused slots past the fixed PIDs are left for k_alloc_pid
+        if (g_proc_table[i].m_pid == -1) {
+            if (i >= NUM_FIXED_PROCS) {
+                g_free_pids[g_num_free_pids++] = i;
+            }
+            continue;
         }
-        (gp_pcbs[i])->mp_sp = sp;
 
-        // only push non-interrupt processes onto the ready queue
-        if ((gp_pcbs[i])->m_priority != INTERRUPT) {
-            pq_push_ready(gp_pcbs[i]);
-        }
+        init_process(i, alloc_stack(g_proc_table[i].m_stack_size), g_proc_table[i].m_stack_size);
     }
 }
 
-/** Choose which queued process to run next by popping the next ready process
- * from the priority queue.
- *
- * @return global pointer to current process
+/**
+ * Start a time slice for a process about to run, unless it is resuming one an
+ * interrupt cut short. The timer only wakes up at the end of the slice while
+ * a peer at the same priority is ready.
  */
-PCB* scheduler(void) {
-    PCB* old_proc = gp_current_process;
+void start_slice(PCB* proc) {
+    U32 quantum;
+
+    if (proc->m_priority >= NUM_PRIORITIES || proc->m_period != 0) return;
+
+    quantum = g_quantum[proc->m_priority];
+    if (quantum == 0) return;
+
+    if (!proc->m_in_slice) {
+        proc->m_slice_end = k_get_time() + quantum;
+        proc->m_in_slice = 1;
+    }
+
+    if (!pq_is_priority_empty(&g_ready_pq, proc->m_priority)) {
+        k_timer_wakeup_at(proc->m_slice_end);
+    }
+}
+
+/* 1 if the time slice of a process has run out, 0 otherwise */
+int slice_expired(PCB* proc) {
+    return proc->m_in_slice && (int)(k_get_time() - proc->m_slice_end) >= 0;
+}
+
+/* Put a process that is giving up the processor on the queue for its state */
+void requeue_process(PCB* old_proc) {
     if (old_proc != NULL && old_proc->m_priority != INTERRUPT) {
         switch (old_proc->m_state) {
         case STATE_BLOCKED_MEMORY:
             pq_push_blocked(old_proc);
             break;
         case STATE_BLOCKED_MSG:
+            pq_push(&g_msg_blocked_pq, old_proc);
+            break;
+        case STATE_BLOCKED_SEND:
+            pq_push(&g_send_blocked_pq, old_proc);
+            break;
+        case STATE_EXITED:
+        case STATE_SLEEP:
+            // on no queue, a sleeping process waits on the timed wait list
             break;
         case STATE_NEW:
         case STATE_READY:
         case STATE_RUN:
             // if this process got interrupted, we will resume it after the interrupt
-            // handler has run
-            if (timer_i_proc_pending || uart_i_proc_pending) {
+            // handler has run, unless its time slice ran out
+            if (k_irq_pending() && !slice_expired(old_proc)) {
                 pq_push_ready_front(old_proc);
-            } else {
-                pq_push_ready(old_proc);
+                return;
             }
 
+            pq_push_ready(old_proc);
             break;
         default:
             logln("scheduler: unknown state");
             break;
         }
+
+        // the next time the process runs it gets a whole slice
+        old_proc->m_in_slice = 0;
+    }
+}
+
+/** Choose which queued process to run next by popping the next ready process
+ * from the priority queue.
+ *
+ * @return global pointer to current process
+ */
+PCB* scheduler(void) {
+    PCB* next;
+
+    if (g_irq_current != -1) {
+        // the interrupt process is done, so its interrupt may fire again. The
+        // NVIC latched it while it was masked; if it is still asserted it is
+        // raised again right away
+        NVIC_ClearPendingIRQ((IRQn_Type) g_irq_slot_irq[g_irq_current]);
+        NVIC_EnableIRQ((IRQn_Type) g_irq_slot_irq[g_irq_current]);
+        g_irq_current = -1;
+    }
+
+    requeue_process(gp_current_process);
+
+    // whatever switch this is also satisfies a deferred one, including a
+    // timer wakeup raised while requeueing, which is dispatched below
+    g_reschedule_pending = 0;
+
+    // a handoff waits behind an interrupt process on the ready queue, where a
+    // timeout expiring in the meantime can find it
+    if (gp_handoff_process != NULL && k_irq_pending()) {
+        pq_push_ready_front(gp_handoff_process);
+        gp_handoff_process = NULL;
     }
 
-    if (timer_i_proc_pending) {
-        timer_i_proc_pending = 0;
-        return gp_pcbs[PID_TIMER_IPROC];
-    } else if (uart_i_proc_pending) {
-        uart_i_proc_pending = 0;
-        return gp_pcbs[PID_UART_IPROC];
+    next = next_irq_process();
+    if (next != NULL) {
+        return next;
+    } else if (gp_handoff_process != NULL) {
+        next = gp_handoff_process;
+        gp_handoff_process = NULL;
+        return next;
     } else {
         return pq_pop_ready();
     }
 }
 
-__asm __new_kernel_proc_rte() {
-    POP {r0 - r4, r12, pc}
-}
-
-/*@brief: switch out old pcb (p_pcb_old), run the new pcb (gp_current_process)
- *@param: p_pcb_old, the old pcb that was in STATE_RUN
+/*@brief: switch out old pcb (p_pcb_old), run the new pcb (gp_current_process).
+ *        Called from PendSV, which has already saved the rest of the old
+ *        process's registers on its stack and restores the new one's after
+ *@param: p_pcb_old, the old pcb that was in STATE_RUN, NULL when starting up
  *@return: RTX_OK upon success
- *         RTX_ERR upon failure
- *PRE:  p_pcb_old and gp_current_process are pointing to valid PCBs.
- *POST: if gp_current_process was NULL, then it gets set to pcbs[0].
- *      No other effect on other global variables.
+ *PRE:  gp_current_process is pointing to a valid PCB.
+ *POST: PSP is the stack pointer of gp_current_process.
  */
 int process_switch(PCB* p_pcb_old) {
-    U32 state = gp_current_process->m_state;
-
-    if (state == STATE_NEW) {
-        if (gp_current_process != p_pcb_old && p_pcb_old->m_state != STATE_NEW) {
-            switch (p_pcb_old->m_state) {
-            case STATE_RUN:
-            case STATE_READY:
-                p_pcb_old->m_state = STATE_READY;
-                break;
-            case STATE_BLOCKED_MEMORY:
-            case STATE_BLOCKED_MSG:
-                // Don't set state to STATE_READY
-                break;
-            case STATE_NEW:
-                logln("process_switch: process has state STATE_NEW but shouldn't");
-                break;
-            default:
-                logln("process_switch: unknown state");
-                break;
-            };
-
-            p_pcb_old->mp_sp = (U32*) __get_MSP();
-        }
-
-        gp_current_process->m_state = STATE_RUN;
-        __set_MSP((U32) gp_current_process->mp_sp);
-
-        switch (gp_current_process->m_pid) {
-        case PID_NULL:
-        case PID_SET_PRIO:
-        case PID_KCD:
-        case PID_CRT:
-        case PID_TIMER_IPROC:
-        case PID_UART_IPROC:
-            // any process requiring kernel functions should call this
-            __new_kernel_proc_rte();
+    if (p_pcb_old != NULL && p_pcb_old != gp_current_process) {
+        switch (p_pcb_old->m_state) {
+        case STATE_RUN:
+        case STATE_READY:
+            p_pcb_old->m_state = STATE_READY;
+            break;
+        case STATE_BLOCKED_MEMORY:
+        case STATE_BLOCKED_MSG:
+        case STATE_BLOCKED_SEND:
+        case STATE_SLEEP:
+        case STATE_EXITED:
+            // Don't set state to STATE_READY
+            break;
+        case STATE_NEW:
+            logln("process_switch: process has state STATE_NEW but shouldn't");
             break;
         default:
-            // pop exception stack frame from the stack for a new processes
-            __rte();
+            logln("process_switch: unknown state");
             break;
-        }
+        };
     }
 
-    /* The following will only execute if the if block above is FALSE */
-    if (gp_current_process != p_pcb_old) {
-        if (state == STATE_READY) {
-            switch (p_pcb_old->m_state) {
-            case STATE_RUN:
-            case STATE_READY:
-                p_pcb_old->m_state = STATE_READY;
-                break;
-            case STATE_BLOCKED_MEMORY:
-            case STATE_BLOCKED_MSG:
-                // Don't set state to STATE_READY
-                break;
-            case STATE_NEW:
-                logln("process_switch: process has state STATE_NEW but shouldn't");
-                break;
-            default:
-                logln("process_switch: unknown state");
-                break;
-            };
-
-            p_pcb_old->mp_sp = (U32*) __get_MSP();  // save the old process's sp
-            gp_current_process->m_state = STATE_RUN;
-            __set_MSP((U32) gp_current_process->mp_sp); //switch to the new proc's stack
-        } else {
-            gp_current_process = p_pcb_old; // revert back to the old proc on error
-            return RTX_ERR;
-        }
+    if (p_pcb_old != NULL) {
+        // also when the old process keeps running, PendSV restores its context from mp_sp
+        p_pcb_old->mp_sp = (U32*) __get_PSP(); // save the old process's sp
     }
 
+    // a new process starts from the context frame init_process built
+    gp_current_process->m_state = STATE_RUN;
+    __set_PSP((U32) gp_current_process->mp_sp); // switch to the new proc's stack
+
     return RTX_OK;
 }
 
 /**
  * Remove the current process from the processor. A new process is determined
- * using the scheduler, and the old process is queued.
+ * using the scheduler, and the old process is queued. The switch happens in
+ * PendSV, which is taken as soon as interrupts are enabled, so this returns
+ * once the current process is picked to run again.
 
- * @return 0 on success, -1 on error
- * POST gp_current_process gets updated to next to run process
+ * @return 0 on success
  */
 int k_release_processor(void) {
-    PCB* p_pcb_old = gp_current_process;
-    gp_current_process = scheduler();
-
-    if (gp_current_process == NULL) { // should never occur
-        gp_current_process = p_pcb_old; // revert back to the old process
-        return RTX_ERR;
+    U32 primask = __get_PRIMASK();
+
+    g_reschedule_pending = 1;
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    __DSB();
+    __ISB();
+
+    // a kernel call runs with interrupts disabled, open them just for the switch
+    if (primask) {
+        __enable_irq();
+        __ISB();
+        __disable_irq();
     }
 
-    if (p_pcb_old == NULL) { // this only happens once on initialization
-        p_pcb_old = gp_current_process;
+    return RTX_OK;
+}
+
+/**
+ * Switch straight to a process that was just unblocked and is on no queue,
+ * skipping the trip through the ready queue. Falls back to the scheduler when
+ * an interrupt process is pending or a ready process outranks target.
+ *
+ * @return 0 on success, -1 on error
+ */
+int k_handoff(PCB* target) {
+    if (k_irq_pending() || ready_outranks(target)) {
+        pq_push_ready(target);
+    } else {
+        gp_handoff_process = target;
     }
 
-    process_switch(p_pcb_old);
+    return k_release_processor();
+}
+/* Change the priority a process is scheduled at, requeueing it on whichever
+ * queue it is on */
+void set_effective_priority(PCB* process, int priority) {
+    PQ* queue = process->mp_queue;
 
-    return RTX_OK;
+    // EDF processes stay at HIGH, ahead of every static priority
+    if (process->m_period != 0) return;
+
+    if (queue != NULL) {
+        pq_pop_PCB(queue, process);
+    }
+
+    process->m_priority = priority;
+    if (queue != NULL) {
+        pq_push(queue, process);
+    }
 }
+
 /**
  * Set the priority of a specified process. The process will be pushed back onto
  * the priority queue. If the process is unblocked and the new priority is
@@ -279,6 +515,10 @@ int k_release_processor(void) {
  */
 int k_set_process_priority(const int process_id, const int priority) {
     PCB* process;
+    int boosted;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
 
     switch (process_id) {
         case PID_NULL:
@@ -290,42 +530,135 @@ int k_set_process_priority(const int process_id, const int priority) {
     }
     if (priority < HIGH || priority > LOWEST) return RTX_ERR;
 
-    if (process_id == gp_current_process->m_pid) {
-        gp_current_process->m_priority = priority;
-        return k_release_processor();
+    process = gp_pcbs[process_id];
+    if (process == NULL) {
+        logln("k_set_process_priority: trying to set the priority of process with id: %d, but process was not found", process_id);
+        return RTX_ERR;
     }
 
-    process = pq_pop_PCB_ready(gp_pcbs[process_id]);
-    if (process == NULL) {
-        process = pq_pop_PCB_blocked(gp_pcbs[process_id]);
+    // an inherited priority stays in effect until it drops below the new one
+    boosted = process->m_priority < process->m_base_priority;
+    process->m_base_priority = priority;
+    if (!boosted || priority < process->m_priority) {
+        set_effective_priority(process, priority);
     }
-    if (process == NULL) {
-        process = gp_pcbs[process_id];
+
+    k_request_reschedule();
+    return RTX_OK;
+}
+
+/**
+ * Set the time slice of the processes at a priority. A process that uses up
+ * its slice goes behind the other ready processes at its priority.
+ *
+ * @param priority priority in [HIGH, LOWEST]
+ * @param quantum time slice in ms, or 0 to let processes run until they yield
+ * @return 0 on success, -1 if error
+ */
+int k_set_time_quantum(int priority, int quantum) {
+    if (priority < HIGH || priority > LOWEST) return RTX_ERR;
+    if (quantum < 0) return RTX_ERR;
+
+    g_quantum[priority] = quantum;
+    return RTX_OK;
+}
+
+/* Take an EDF process off the deadline list, if it is on it */
+void disarm_deadline(PCB* proc) {
+    PCB** p_link = &gp_deadline_front;
+
+    while (*p_link != NULL && *p_link != proc) {
+        p_link = &(*p_link)->mp_deadline_next;
+    }
+    if (*p_link != NULL) {
+        *p_link = proc->mp_deadline_next;
+        proc->mp_deadline_next = NULL;
     }
+}
 
-    if (process == NULL) {
-        logln("k_set_process_priority: trying to set the priority of process with id: %d, but process was not found", process_id);
-        return RTX_ERR;
+/* Watch for the current m_deadline of an EDF process to pass, see
+ * k_check_deadlines */
+void arm_deadline(PCB* proc) {
+    PCB** p_link = &gp_deadline_front;
+
+    disarm_deadline(proc);
+    proc->m_deadline_missed = 0;
+
+    while (*p_link != NULL && (int)((*p_link)->m_deadline - proc->m_deadline) <= 0) {
+        p_link = &(*p_link)->mp_deadline_next;
     }
+    proc->mp_deadline_next = *p_link;
+    *p_link = proc;
 
-    process->m_priority = priority;
-    switch (process->m_state) {
-    case STATE_NEW:
-    case STATE_READY:
-        pq_push_ready(process);
-        break;
-    case STATE_BLOCKED_MSG:
-        break;
-    case STATE_BLOCKED_MEMORY:
-        pq_push_blocked(process);
-        break;
-    case STATE_RUN:
-        logln("k_set_process_priority: process has state STATE_RUN but is not current running process");
-        break;
-    default:
-        logln("k_set_process_priority: unknown state");
-        break;
-    };
+    k_timer_wakeup_at(proc->m_deadline + 1);
+}
+
+/**
+ * Move the current process into the EDF class, or back to its static
+ * priority. An EDF process runs ahead of every static priority, earliest
+ * absolute deadline first. Its first job is due period ms from now, and each
+ * k_wait_next_period ends a job.
+ *
+ * @param period period and relative deadline in ms, or 0 to leave the class
+ * @return 0 on success, -1 if error
+ */
+int k_set_edf_period(int period) {
+    PCB* process = gp_current_process;
+
+    if (period < 0) return RTX_ERR;
+    if (process->m_pid == PID_NULL || process->m_priority == INTERRUPT) return RTX_ERR;
+
+    if (period == 0) {
+        process->m_period = 0;
+        process->m_priority = process->m_base_priority;
+        disarm_deadline(process);
+    } else {
+        process->m_period = period;
+        process->m_deadline = k_get_time() + period;
+        process->m_priority = HIGH;
+        arm_deadline(process);
+    }
+
+    k_request_reschedule();
+    return RTX_OK;
+}
+
+/**
+ * End the current job of an EDF process. A job that finished past its
+ * deadline starts the next job right away, its miss counted by
+ * k_check_deadlines unless the timer has not got to it yet; otherwise the
+ * process sleeps until its next period begins at the deadline just met.
+ * Either way the deadlines stay on the grid set by k_set_edf_period.
+ *
+ * @return 0 on success, -1 if the current process is not an EDF process
+ */
+int k_wait_next_period(void) {
+    PCB* process = gp_current_process;
+    U32 now = k_get_time();
+    U32 release = process->m_deadline;
+
+    if (process->m_period == 0) return RTX_ERR;
+
+    process->m_deadline += process->m_period;
+
+    if ((int)(now - release) > 0) {
+        if (!process->m_deadline_missed) {
+            process->m_deadline_misses++;
+            g_deadline_misses++;
+        }
+
+        // periods that passed entirely while the job overran are skipped
+        while ((int)(now - process->m_deadline) >= 0) {
+            process->m_deadline += process->m_period;
+        }
+        arm_deadline(process);
+        return k_release_processor();
+    }
+
+    arm_deadline(process);
+
+    process->m_state = STATE_SLEEP;
+    k_add_timeout(process, release);
 
     return k_release_processor();
 }
@@ -338,22 +671,87 @@ int k_get_process_priority(const int process_id) {
     PCB* process;
 
     if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
 
     process = gp_pcbs[process_id];
-    return process->m_priority;
+    return process->m_base_priority;
+}
+
+/**
+ * Make the current process inherit the priority of the highest priority
+ * sender of the messages waiting for it, until its message queue drains.
+ *
+ * @param enable 1 to turn inheritance on, 0 to turn it off
+ * @return 0 on success
+ */
+int k_set_priority_inheritance(int enable) {
+    gp_current_process->m_inherit = (enable != 0);
+
+    if (!enable && gp_current_process->m_priority != gp_current_process->m_base_priority) {
+        set_effective_priority(gp_current_process, gp_current_process->m_base_priority);
+        k_request_reschedule();
+    }
+
+    return RTX_OK;
+}
+
+/* Raise an inheriting process to the priority of the sender of a new message */
+void inherit_priority(PCB* target, MSG_BUF* message) {
+    PCB* sender;
+
+    if (!target->m_inherit) return;
+    if (message->m_send_pid < 0 || message->m_send_pid >= NUM_PROCS) return;
+    if (g_proc_table[message->m_send_pid].m_pid == -1) return;
+
+    // delayed messages are enqueued by the timer i-process on behalf of their sender
+    sender = gp_pcbs[message->m_send_pid];
+    if (sender->m_priority < target->m_priority) {
+        set_effective_priority(target, sender->m_priority);
+    }
 }
 
-/* Adds a given message to the target's message queue*/
+/* Adds a given message to the target's message queue. The queue is ordered by
+ * message priority and FIFO within a priority, so a message of the default
+ * (lowest) priority is always appended in constant time */
 void enqueue_message(PCB* target, MSG_BUF* message) {
+    MSG_BUF* prev;
+
     message->mp_next = NULL;
+    target->m_msg_count++;
+    inherit_priority(target, message);
 
     if (target->mp_msg_queue_back == NULL) {
         target->mp_msg_queue_front = message;
-    } else {
+        target->mp_msg_queue_back = message;
+    } else if (MSG_PRIORITY(target->mp_msg_queue_back) <= MSG_PRIORITY(message)) {
         target->mp_msg_queue_back->mp_next = message;
+        target->mp_msg_queue_back = message;
+    } else if (MSG_PRIORITY(target->mp_msg_queue_front) > MSG_PRIORITY(message)) {
+        message->mp_next = target->mp_msg_queue_front;
+        target->mp_msg_queue_front = message;
+    } else {
+        // insert behind the last message of the same or a higher priority
+        prev = target->mp_msg_queue_front;
+        while (MSG_PRIORITY((MSG_BUF*)prev->mp_next) <= MSG_PRIORITY(message)) {
+            prev = prev->mp_next;
+        }
+        message->mp_next = prev->mp_next;
+        prev->mp_next = message;
     }
+}
+
+/* The message a dequeued queue entry stands for. A published message's entry
+ * goes back to the spare list */
+MSG_BUF* resolve_message(MSG_BUF* message) {
+    MSG_REF* ref = (MSG_REF*)message;
 
-    target->mp_msg_queue_back = message;
+    if (ref < g_msg_refs || ref >= g_msg_refs + NUM_MSG_REFS) return message;
+
+    ref->m_env.mp_next = gp_free_msg_refs;
+    gp_free_msg_refs = ref;
+    g_num_free_msg_refs++;
+
+    return ref->mp_shared;
 }
 
 MSG_BUF* dequeue_message(PCB* target) {
@@ -361,7 +759,11 @@ MSG_BUF* dequeue_message(PCB* target) {
 
     if (return_val == NULL) {
         // Empty queue, don't do anything
-    } else if (return_val == target->mp_msg_queue_back) {
+        return NULL;
+    }
+
+    target->m_msg_count--;
+    if (return_val == target->mp_msg_queue_back) {
         // Queue with exactly one element
         target->mp_msg_queue_front = NULL;
         target->mp_msg_queue_back = NULL;
@@ -370,81 +772,938 @@ MSG_BUF* dequeue_message(PCB* target) {
         target->mp_msg_queue_front = return_val->mp_next;
     }
 
-    return return_val;
+    return resolve_message(return_val);
 }
 
-MSG_BUF* create_message_headers(void* p_msg_envelope, int target_proc_id) {
-    MSG_BUF* message = (MSG_BUF*) p_msg_envelope;
+/* 1 if a message passes the receive filter of a process, 0 otherwise */
+int message_matches(PCB* target, MSG_BUF* message) {
+    return (target->m_match_pid == ANY_PID || message->m_send_pid == target->m_match_pid)
+        && (target->m_match_type == ANY_TYPE || message->mtype == target->m_match_type);
+}
+
+/* Unlink the first message that passes the receive filter of target, if any */
+MSG_BUF* dequeue_message_match(PCB* target) {
+    MSG_BUF* prev = NULL;
+    MSG_BUF* message = target->mp_msg_queue_front;
+
+    if (target->m_match_pid == ANY_PID && target->m_match_type == ANY_TYPE) {
+        return dequeue_message(target);
+    }
+
+    while (message != NULL && !message_matches(target, message)) {
+        prev = message;
+        message = message->mp_next;
+    }
+
+    if (message == NULL) return NULL;
+
+    if (prev == NULL) {
+        target->mp_msg_queue_front = message->mp_next;
+    } else {
+        prev->mp_next = message->mp_next;
+    }
+    if (target->mp_msg_queue_back == message) {
+        target->mp_msg_queue_back = prev;
+    }
     message->mp_next = NULL;
-    message->m_send_pid = gp_current_process->m_pid;
-    message->m_recv_pid = target_proc_id;
-    message->m_expiry = 0;
-    return message;
+    target->m_msg_count--;
+
+    return resolve_message(message);
 }
 
-int k_send_message_internal(int process_id, MSG_BUF* message) {
-    PCB* target = gp_pcbs[process_id];
-    enqueue_message(target, message);
+/* 1 if the mailbox of target has no room for num more messages, 0 otherwise.
+ * More messages than the capacity fit once the mailbox is empty */
+int mailbox_full(PCB* target, int num) {
+    if (num > target->m_msg_capacity) {
+        num = target->m_msg_capacity;
+    }
+    return target->m_msg_capacity > 0 && target->m_msg_count + num > target->m_msg_capacity;
+}
 
-    if (target->m_state == STATE_BLOCKED_MSG) {
-        target->m_state = STATE_READY;
-        pq_push_ready(target);
-        // DO WE CALL RELEASE HERE??? WHAT IF CURR PROC HAS HIGHEST PRIORITY
-        // slides don't have this call
-        if (target->m_priority < gp_current_process->m_priority && gp_current_process->m_priority != INTERRUPT) {
-            return k_release_processor();
+/**
+ * Make the highest priority process waiting for room in the mailbox of target
+ * ready.
+ *
+ * @return the process, or NULL if none is waiting
+ */
+PCB* wake_blocked_sender(PCB* target) {
+    int i;
+    PCB* proc;
+
+    for (i = pq_top_priority(&g_send_blocked_pq); i < NUM_PRIORITIES; i++) {
+        for (proc = g_send_blocked_pq.front[i]; proc != NULL; proc = proc->mp_next) {
+            if (proc->m_send_target == target->m_pid) {
+                pq_pop_PCB(&g_send_blocked_pq, proc);
+                proc->m_state = STATE_READY;
+                pq_push_ready(proc);
+                return proc;
+            }
         }
     }
 
-    return RTX_OK;
+    return NULL;
 }
 
 /**
- * Adds the given message to the given PCB
- * Sends message to given process id
- * Preempts if higher priority proc waiting for message
+ * Block the current process until the mailbox of process_id has room for num
+ * messages. Interrupt processes cannot block, so their messages are always let
+ * through.
+ *
+ * @param block 0 to fail instead of blocking
+ * @return 0 once there is room, -1 if the mailbox is full and the process
+ *         cannot block, or the receiver exited while it waited
  */
-int k_send_message(int process_id, void* p_msg_envelope) {
-    MSG_BUF* message = create_message_headers(p_msg_envelope, process_id);
-    return k_send_message_internal(process_id, message);
-}
+int wait_for_mailbox(int process_id, int num, int block) {
+    PCB* target = gp_pcbs[process_id];
+    U32 generation = g_pid_generation[process_id];
 
-int k_delayed_send(int process_id, void* p_msg_envelope, int delay) {
-    MSG_BUF* message = create_message_headers(p_msg_envelope, process_id);
-    PCB* target;
+    if (gp_current_process->m_priority == INTERRUPT) return RTX_OK;
 
-    if (delay == 0) {
-        return k_send_message_internal(process_id, message);
-    }
+    while (mailbox_full(target, num)) {
+        if (!block) return RTX_ERR;
 
-    target = gp_pcbs[process_id];
-    insert_message_delayed(target, message, delay);
+        gp_current_process->m_state = STATE_BLOCKED_SEND;
+        gp_current_process->m_send_target = process_id;
+        k_release_processor();
+
+        // the receiver exited, and its process id may belong to a new process by now
+        if (g_pid_generation[process_id] != generation) return RTX_ERR;
+    }
 
     return RTX_OK;
 }
 
 /**
- * Blocking recieve
- * sets sender_id's value to the id of the proc ID of the sender
+ * Limit how many messages other processes may queue for the current process.
+ * Senders to a full mailbox block until a receive makes room.
+ *
+ * @param capacity most queued messages, or 0 for no limit
+ * @return 0 on success, -1 if capacity is negative
  */
-void* k_receive_message(int* sender_id) {
-    MSG_BUF* message = dequeue_message(gp_current_process);
+int k_set_mailbox_capacity(int capacity) {
+    int woken = 0;
+
+    if (capacity < 0) return RTX_ERR;
+
+    gp_current_process->m_msg_capacity = capacity;
+
+    // wake as many senders as there is new room for
+    while ((capacity == 0 || gp_current_process->m_msg_count + woken < capacity)
+           && wake_blocked_sender(gp_current_process) != NULL) {
+        woken++;
+    }
+
+    if (woken > 0) {
+        k_request_reschedule();
+    }
+    return RTX_OK;
+}
+
+MSG_BUF* create_message_headers(void* p_msg_envelope, int target_proc_id) {
+    MSG_BUF* message = (MSG_BUF*) p_msg_envelope;
+    message->mp_next = NULL;
+    message->m_send_pid = gp_current_process->m_pid;
+    message->m_recv_pid = target_proc_id;
+    message->m_expiry = 0;
+    MSG_HANDLE(message) = 0;
+    MSG_PERIOD(message) = 0;
+    MSG_PRIORITY(message) = MSG_PRIORITY_DEFAULT;
+    return message;
+}
+
+/* Make target ready if it is blocked on a receive that message satisfies.
+ * Returns 1 if it was woken, 0 otherwise */
+int wake_receiver(PCB* target, MSG_BUF* message) {
+    if (target->m_state != STATE_BLOCKED_MSG || !message_matches(target, message)) return 0;
+
+    pq_pop_PCB(&g_msg_blocked_pq, target);
+    target->m_state = STATE_READY;
+    pq_push_ready(target);
+
+    return 1;
+}
+
+/* Wake target if it is blocked on a receive that message satisfies, and
+ * preempt the current process if target outranks it */
+int notify_receiver(PCB* target, MSG_BUF* message) {
+    if (wake_receiver(target, message) && k_outranks(target, gp_current_process)) {
+        k_request_reschedule();
+    }
+
+    return RTX_OK;
+}
+
+int k_send_message_internal(int process_id, MSG_BUF* message) {
+    PCB* target = gp_pcbs[process_id];
+    enqueue_message(target, message);
+
+    return notify_receiver(target, message);
+}
+
+/**
+ * Adds the given message to the given PCB
+ * Sends message to given process id
+ * Preempts if higher priority proc waiting for message
+ */
+int k_send_message(int process_id, void* p_msg_envelope) {
+    MSG_BUF* message;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (k_block_shared(p_msg_envelope)) return RTX_ERR; // published, other subscribers still hold it
+
+    if (wait_for_mailbox(process_id, 1, 1) == RTX_ERR) return RTX_ERR;
+
+    message = create_message_headers(p_msg_envelope, process_id);
+    return k_send_message_internal(process_id, message);
+}
+
+/**
+ * Sends a message unless the mailbox of the receiver is full.
+ *
+ * @return 0 on success, -1 if the mailbox is full or error
+ */
+int k_try_send_message(int process_id, void* p_msg_envelope) {
+    MSG_BUF* message;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (k_block_shared(p_msg_envelope)) return RTX_ERR;
+    if (wait_for_mailbox(process_id, 1, 0) == RTX_ERR) return RTX_ERR;
+
+    message = create_message_headers(p_msg_envelope, process_id);
+    return k_send_message_internal(process_id, message);
+}
+
+/**
+ * Pass a received message on to another process. Unlike k_send_message the
+ * header is left alone, so the receiver sees the original sender. A header
+ * that names no live sender, e.g. of a block that was never sent, is filled
+ * in as by k_send_message instead.
+ *
+ * @return 0 on success, -1 if error
+ */
+int k_forward_message(int process_id, void* p_msg_envelope) {
+    MSG_BUF* message = (MSG_BUF*) p_msg_envelope;
+    int sender;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (k_block_size(p_msg_envelope) == 0) return RTX_ERR;
+    if (k_block_shared(p_msg_envelope)) return RTX_ERR;
+    if (wait_for_mailbox(process_id, 1, 1) == RTX_ERR) return RTX_ERR;
+
+    sender = message->m_send_pid;
+    if (sender < 0 || sender >= NUM_PROCS || g_proc_table[sender].m_pid == -1) {
+        message = create_message_headers(p_msg_envelope, process_id);
+    } else if (MSG_PRIORITY(message) < HIGH || MSG_PRIORITY(message) > LOWEST) {
+        MSG_PRIORITY(message) = MSG_PRIORITY_DEFAULT;
+    }
+
+    message->m_recv_pid = process_id;
+    return k_send_message_internal(process_id, message);
+}
+
+/**
+ * Send several messages to one process, appending them to its queue as a
+ * single chain. The messages are received in array order.
+ *
+ * @param p_msg_envelopes array of message envelopes
+ * @param num_msgs number of messages in p_msg_envelopes
+ * @return 0 on success, -1 if error
+ */
+int k_send_batch(int process_id, void** p_msg_envelopes, int num_msgs) {
+    PCB* target;
+    MSG_BUF* first;
+    MSG_BUF* last;
+    MSG_BUF* match;
+    int i;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (p_msg_envelopes == NULL || num_msgs <= 0) return RTX_ERR;
+    for (i = 0; i < num_msgs; i++) {
+        if (k_block_shared(p_msg_envelopes[i])) return RTX_ERR;
+    }
+    if (wait_for_mailbox(process_id, num_msgs, 1) == RTX_ERR) return RTX_ERR;
+
+    target = gp_pcbs[process_id];
+    first = create_message_headers(p_msg_envelopes[0], process_id);
+    last = first;
+    for (i = 1; i < num_msgs; i++) {
+        last->mp_next = create_message_headers(p_msg_envelopes[i], process_id);
+        last = last->mp_next;
+    }
+
+    // default priority messages always go behind everything already queued
+    inherit_priority(target, first);
+    if (target->mp_msg_queue_back == NULL) {
+        target->mp_msg_queue_front = first;
+    } else {
+        target->mp_msg_queue_back->mp_next = first;
+    }
+    target->mp_msg_queue_back = last;
+    target->m_msg_count += num_msgs;
+
+    if (target->m_state != STATE_BLOCKED_MSG) return RTX_OK;
+
+    match = first;
+    while (match != NULL && !message_matches(target, match)) {
+        match = match->mp_next;
+    }
+    if (match == NULL) return RTX_OK;
+
+    return notify_receiver(target, match);
+}
+
+/* Topic called name, or NULL if there is none */
+TOPIC* find_topic(const char* name) {
+    int i;
+
+    for (i = 0; i < NUM_TOPICS; i++) {
+        if (g_topics[i].m_name[0] != '\0' && strncmp(g_topics[i].m_name, name, TOPIC_NAME_LEN) == 0) {
+            return &g_topics[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* 1 if the name of a topic is non-empty and fits in TOPIC_NAME_LEN, 0 otherwise */
+int valid_topic_name(const char* name) {
+    return name != NULL && name[0] != '\0' && strlen(name) < TOPIC_NAME_LEN;
+}
+
+/**
+ * Subscribe the current process to a topic, creating the topic if needed.
+ *
+ * @param topic name of the topic, shorter than TOPIC_NAME_LEN
+ * @return 0 on success, -1 if the name is invalid or all topics are in use
+ */
+int k_subscribe(const char* topic) {
+    TOPIC* p_topic;
+    int pid = gp_current_process->m_pid;
+    int i;
+
+    if (!valid_topic_name(topic)) return RTX_ERR;
+
+    p_topic = find_topic(topic);
+    for (i = 0; p_topic == NULL && i < NUM_TOPICS; i++) {
+        if (g_topics[i].m_name[0] == '\0') {
+            p_topic = &g_topics[i];
+            strcpy(p_topic->m_name, topic);
+        }
+    }
+    if (p_topic == NULL) return RTX_ERR;
+
+    if (!(p_topic->m_subscribers[pid >> 5] & PID_BIT(pid))) {
+        p_topic->m_subscribers[pid >> 5] |= PID_BIT(pid);
+        p_topic->m_num_subscribers++;
+    }
+    return RTX_OK;
+}
+
+/* Remove a subscriber from a topic, freeing the topic once nobody listens */
+void remove_subscriber(TOPIC* p_topic, int pid) {
+    if (!(p_topic->m_subscribers[pid >> 5] & PID_BIT(pid))) return;
+
+    p_topic->m_subscribers[pid >> 5] &= ~PID_BIT(pid);
+    if (--p_topic->m_num_subscribers == 0) {
+        p_topic->m_name[0] = '\0';
+    }
+}
+
+/**
+ * Unsubscribe the current process from a topic.
+ *
+ * @return 0 on success, -1 if there is no such topic
+ */
+int k_unsubscribe(const char* topic) {
+    TOPIC* p_topic;
+
+    if (!valid_topic_name(topic)) return RTX_ERR;
+
+    p_topic = find_topic(topic);
+    if (p_topic == NULL) return RTX_ERR;
+
+    remove_subscriber(p_topic, gp_current_process->m_pid);
+    return RTX_OK;
+}
+
+/**
+ * Deliver one message to every subscriber of a topic. The subscribers share
+ * the memory block, which goes back to the heap once each of them has
+ * released it.
+ *
+ * @return 0 on success, -1 if the topic has no subscribers or there are not
+ *         enough spare queue entries. The message still belongs to the caller
+ *         on failure
+ */
+int k_publish(const char* topic, void* p_msg_envelope) {
+    TOPIC* p_topic;
+    MSG_BUF* message;
+    MSG_REF* ref;
+    PCB* target;
+    U32 bits;
+    int num_subscribers;
+    int preempt = 0;
+    int pid;
+    int i;
+
+    if (!valid_topic_name(topic)) return RTX_ERR;
+    if (k_block_size(p_msg_envelope) == 0) return RTX_ERR;
+    if (k_block_shared(p_msg_envelope)) return RTX_ERR;
+
+    p_topic = find_topic(topic);
+    if (p_topic == NULL) return RTX_ERR;
+
+    num_subscribers = p_topic->m_num_subscribers;
+    if (num_subscribers == 0 || num_subscribers - 1 > g_num_free_msg_refs) return RTX_ERR;
+
+    message = create_message_headers(p_msg_envelope, -1);
+    k_share_block(message, num_subscribers - 1);
+
+    // the first subscriber gets the message itself, the others a stand-in
+    for (i = 0; i < NUM_PID_WORDS; i++) {
+        for (bits = p_topic->m_subscribers[i]; bits != 0; bits &= ~PID_BIT(pid)) {
+            pid = (i << 5) + __clz(bits);
+            target = gp_pcbs[pid];
+
+            if (message->m_recv_pid == -1) {
+                message->m_recv_pid = pid;
+                enqueue_message(target, message);
+                preempt |= wake_receiver(target, message) && k_outranks(target, gp_current_process);
+                continue;
+            }
+
+            ref = gp_free_msg_refs;
+            gp_free_msg_refs = ref->m_env.mp_next;
+            g_num_free_msg_refs--;
+
+            ref->m_env = *message;
+            ref->m_env.m_recv_pid = pid;
+            ref->mp_shared = message;
+            enqueue_message(target, &ref->m_env);
+            preempt |= wake_receiver(target, &ref->m_env) && k_outranks(target, gp_current_process);
+        }
+    }
+
+    if (preempt) {
+        k_request_reschedule();
+    }
+    return RTX_OK;
+}
+
+/**
+ * Sends a message that the receiver gets ahead of every queued message of a
+ * lower priority.
+ *
+ * @param priority message priority in [HIGH, LOWEST]
+ * @return 0 on success, -1 if error
+ */
+int k_send_message_priority(int process_id, void* p_msg_envelope, int priority) {
+    MSG_BUF* message;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (k_block_shared(p_msg_envelope)) return RTX_ERR;
+    if (priority < HIGH || priority > LOWEST) return RTX_ERR;
+    if (wait_for_mailbox(process_id, 1, 1) == RTX_ERR) return RTX_ERR;
+
+    message = create_message_headers(p_msg_envelope, process_id);
+    MSG_PRIORITY(message) = priority;
+    return k_send_message_internal(process_id, message);
+}
+
+/**
+ * Sends a message to a given process id after delay ms.
+ *
+ * @return a handle for k_cancel_delayed_send, RTX_OK if delay is 0 and the
+ *         message was sent right away, or -1 if error
+ */
+int k_delayed_send(int process_id, void* p_msg_envelope, int delay) {
+    MSG_BUF* message;
+    PCB* target;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (k_block_shared(p_msg_envelope)) return RTX_ERR;
+    if (delay < 0) return RTX_ERR;
+
+    message = create_message_headers(p_msg_envelope, process_id);
+
+    if (delay == 0) {
+        return k_send_message_internal(process_id, message);
+    }
+
+    target = gp_pcbs[process_id];
+    return insert_message_delayed(target, message, delay);
+}
+
+/**
+ * Sends a message template to a given process id every period ms, starting
+ * one period from now. The template itself is delivered, and goes back on the
+ * timing wheel when the receiver releases it. Deadlines are absolute, so the
+ * ticks keep their phase however late the receiver handles them.
+ *
+ * @param p_msg_template a memory block, owned by the kernel until
+ *        k_cancel_delayed_send returns it
+ * @return a handle for k_cancel_delayed_send, or -1 if error
+ */
+int k_start_periodic(int process_id, void* p_msg_template, int period) {
+    MSG_BUF* message;
+    int handle;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (k_block_shared(p_msg_template)) return RTX_ERR;
+    if (period <= 0) return RTX_ERR;
+    if (k_block_size(p_msg_template) == 0) return RTX_ERR;
+
+    message = create_message_headers(p_msg_template, process_id);
+    handle = insert_message_delayed(gp_pcbs[process_id], message, period);
+    MSG_PERIOD(message) = period;
+
+    return handle;
+}
+
+/**
+ * Send a request and block until process_id replies, handing the processor
+ * straight to process_id if it is waiting for a message. The request is queued
+ * even if the mailbox of process_id is full, see k_set_mailbox_capacity: a
+ * caller that blocked on send as well could deadlock against its server.
+ *
+ * @return the reply, or NULL if error
+ */
+void* k_call(int process_id, void* p_msg_envelope) {
+    MSG_BUF* message;
+    PCB* target;
+
+    // an interrupt process cannot block for the reply
+    if (gp_current_process->m_priority == INTERRUPT) return NULL;
+    if (process_id < 0 || process_id >= NUM_PROCS) return NULL;
+    if (g_proc_table[process_id].m_pid == -1) return NULL;
+    if (k_block_shared(p_msg_envelope)) return NULL;
+    if (process_id == gp_current_process->m_pid) return NULL;
+
+    message = create_message_headers(p_msg_envelope, process_id);
+    target = gp_pcbs[process_id];
+    enqueue_message(target, message);
+
+    gp_current_process->m_match_pid = process_id;
+    gp_current_process->m_match_type = ANY_TYPE;
+    gp_current_process->m_state = STATE_BLOCKED_MSG;
+
+    if (target->m_state == STATE_BLOCKED_MSG && message_matches(target, message)) {
+        pq_pop_PCB(&g_msg_blocked_pq, target);
+        target->m_state = STATE_READY;
+        k_handoff(target);
+    } else {
+        k_release_processor();
+    }
+
+    return k_receive_message_timed(NULL, process_id, ANY_TYPE, WAIT_FOREVER);
+}
+
+/**
+ * Answer a k_call. A caller waiting for this reply that does not rank below
+ * the current process gets the processor straight away. Like the request, the
+ * reply ignores the mailbox capacity of the caller.
+ *
+ * @return 0 on success, -1 if error
+ */
+int k_reply(int process_id, void* p_msg_envelope) {
+    MSG_BUF* message;
+    PCB* target;
+
+    if (process_id < 0 || process_id >= NUM_PROCS) return RTX_ERR;
+    if (g_proc_table[process_id].m_pid == -1) return RTX_ERR;
+    if (k_block_shared(p_msg_envelope)) return RTX_ERR;
+
+    message = create_message_headers(p_msg_envelope, process_id);
+    target = gp_pcbs[process_id];
+    enqueue_message(target, message);
+
+    if (target->m_state == STATE_BLOCKED_MSG && message_matches(target, message)) {
+        pq_pop_PCB(&g_msg_blocked_pq, target);
+        target->m_state = STATE_READY;
+
+        if (!k_outranks(gp_current_process, target) && gp_current_process->m_priority != INTERRUPT) {
+            return k_handoff(target);
+        }
+        pq_push_ready(target);
+    }
+
+    return RTX_OK;
+}
+
+/**
+ * Retract a message queued by k_delayed_send before it is delivered, or stop
+ * a k_start_periodic timer. Only the sender can cancel it. A periodic template
+ * its receiver holds stays there, and is freed when the receiver releases it.
+ *
+ * @param handle the handle returned by k_delayed_send or k_start_periodic
+ * @return the message envelope, owned by the caller again, or NULL if the
+ *         message was already delivered or the handle is invalid
+ */
+void* k_cancel_delayed_send(int handle) {
+    MSG_BUF* message = find_message_delayed(handle);
+
+    if (message == NULL || message->m_send_pid != gp_current_process->m_pid) {
+        return NULL;
+    }
+
+    if (!message_on_wheel(message)) {
+        MSG_HANDLE(message) = 0;
+        MSG_PERIOD(message) = 0;
+        return NULL;
+    }
+
+    remove_message_delayed(message);
+    return (void*)message;
+}
+
+/**
+ * Receive the first message from sender_pid of type mtype, blocking for at
+ * most timeout ms. Other messages stay queued in order and do not wake the
+ * process. The timer i-process wakes the process at the deadline.
+ *
+ * @param sender_id gets set to the id of the sender, unless NULL
+ * @param sender_pid sender to wait for, or ANY_PID
+ * @param mtype message type to wait for, or ANY_TYPE
+ * @param timeout how long to block in ms, NO_WAIT or WAIT_FOREVER
+ * @return the message, or NULL if none arrived in time
+ */
+void* k_receive_message_timed(int* sender_id, int sender_pid, int mtype, int timeout) {
+    MSG_BUF* message;
+    PCB* sender;
+    U32 expiry = k_get_time() + timeout;
+
+    gp_current_process->m_match_pid = sender_pid;
+    gp_current_process->m_match_type = mtype;
+    message = dequeue_message_match(gp_current_process);
+
     while (message == NULL) {
+        if (gp_current_process->m_inherit && gp_current_process->mp_msg_queue_front == NULL) {
+            // served every sender, drop any inherited priority
+            set_effective_priority(gp_current_process, gp_current_process->m_base_priority);
+        }
+
+        if (timeout == NO_WAIT) return NULL;
+        if (timeout != WAIT_FOREVER && (int)(k_get_time() - expiry) >= 0) return NULL;
+
         // No waiting messages, so preempt this process
         gp_current_process->m_state = STATE_BLOCKED_MSG;
+        if (timeout != WAIT_FOREVER) {
+            k_add_timeout(gp_current_process, expiry);
+        }
+
         k_release_processor();
-        message = dequeue_message(gp_current_process);
+
+        if (timeout != WAIT_FOREVER) {
+            k_remove_timeout(gp_current_process);
+        }
+        message = dequeue_message_match(gp_current_process);
     }
     if (sender_id != NULL) {
         *sender_id = message->m_send_pid;
     }
+
+    // the receive made room in a bounded mailbox
+    if (gp_current_process->m_msg_capacity > 0) {
+        sender = wake_blocked_sender(gp_current_process);
+        if (sender != NULL && k_outranks(sender, gp_current_process)) {
+            k_release_processor();
+        }
+    }
+
     return (void*)message;
 }
 
-void k_set_timer_interrupt_pending() {
-    timer_i_proc_pending = 1;
+/**
+ * Blocking recieve
+ * sets sender_id's value to the id of the proc ID of the sender
+ */
+void* k_receive_message(int* sender_id) {
+    return k_receive_message_timed(sender_id, ANY_PID, ANY_TYPE, WAIT_FOREVER);
+}
+
+/* Receive the next message if one is waiting, NULL otherwise */
+void* k_try_receive_message(int* sender_id) {
+    return k_receive_message_timed(sender_id, ANY_PID, ANY_TYPE, NO_WAIT);
+}
+
+/* Receive the next message, or NULL if none arrives within timeout ms */
+void* k_receive_message_timeout(int* sender_id, int timeout) {
+    if (timeout < 0) return NULL;
+    return k_receive_message_timed(sender_id, ANY_PID, ANY_TYPE, timeout);
+}
+
+/* Receive the first message from sender_pid of type mtype, either may be a wildcard */
+void* k_receive_message_match(int sender_pid, int mtype) {
+    return k_receive_message_timed(NULL, sender_pid, mtype, WAIT_FOREVER);
+}
+
+/**
+ * Create a new process at runtime in a free slot of the process table. The new
+ * process preempts the current process if it has a higher priority.
+ *
+ * @param entry entry point of the process
+ * @param priority priority in [HIGH, LOWEST]
+ * @param stack_size stack size in bytes
+ * @return the process id of the new process, or -1 if error
+ */
+int k_create_process(void (*entry)(), int priority, int stack_size) {
+    int pid;
+    U32 size_b = stack_size;
+    U32* sp;
+
+    if (entry == NULL || stack_size <= 0) return RTX_ERR;
+    if (priority < HIGH || priority > LOWEST) return RTX_ERR;
+
+    pid = k_alloc_pid();
+    if (pid == RTX_ERR) {
+        logln("k_create_process: process table is full");
+        return RTX_ERR;
+    }
+
+    sp = k_request_stack(&size_b);
+    if (sp == NULL) {
+        logln("k_create_process: out of stack memory");
+        k_free_pid(pid);
+        return RTX_ERR;
+    }
+
+    g_proc_table[pid].m_pid        = pid;
+    g_proc_table[pid].m_priority   = priority;
+    g_proc_table[pid].m_stack_size = size_b;
+    g_proc_table[pid].mpf_start_pc = entry;
+    init_process(pid, sp, size_b);
+
+    if (k_outranks(gp_pcbs[pid], gp_current_process)) {
+        k_request_reschedule();
+    }
+
+    return pid;
+}
+
+/**
+ * Terminate the current process. Its pending messages, and the delayed ones
+ * still on their way to it, are returned to the heap, and its stack and
+ * process id are recycled for k_create_process.
+ *
+ * @return -1 if the current process cannot exit, otherwise does not return
+ */
+int k_exit_process(void) {
+    PCB* process = gp_current_process;
+    MSG_BUF* message;
+    int i;
+
+    if (process->m_pid == PID_NULL || process->m_priority == INTERRUPT) return RTX_ERR;
+
+    // releasing a block may preempt us, so drain the mailbox while still runnable
+    while ((message = dequeue_message(process)) != NULL) {
+        k_release_memory_block(message);
+    }
+
+    // a process that takes over the id must not get them
+    remove_messages_delayed_to(process->m_pid);
+    disarm_deadline(process);
+
+    // senders waiting for room in the mailbox give up once they run
+    while (wake_blocked_sender(process) != NULL);
+
+    for (i = 0; i < NUM_TOPICS; i++) {
+        if (g_topics[i].m_name[0] != '\0') {
+            remove_subscriber(&g_topics[i], process->m_pid);
+        }
+    }
+
+    process->m_state = STATE_EXITED;
+    k_release_stack(process->mp_stack, process->m_stack_size);
+    k_free_pid(process->m_pid);
+
+    // the scheduler never queues an exited process, so this does not return
+    return k_release_processor();
+}
+
+/**
+ * Give the current blocked wait of a process a deadline. If the process is
+ * still blocked when g_timer reaches expiry, k_expire_timeouts makes it ready.
+ */
+void k_add_timeout(PCB* proc, U32 expiry) {
+    PCB** p_link = &gp_timeout_front;
+
+    proc->m_timeout = expiry;
+    while (*p_link != NULL && (int)((*p_link)->m_timeout - expiry) <= 0) {
+        p_link = &(*p_link)->mp_timeout_next;
+    }
+    proc->mp_timeout_next = *p_link;
+    *p_link = proc;
+
+    k_timer_wakeup_at(expiry);
+}
+
+/* Cancel the deadline of a process, if it still has one */
+void k_remove_timeout(PCB* proc) {
+    PCB** p_link = &gp_timeout_front;
+
+    while (*p_link != NULL) {
+        if (*p_link == proc) {
+            *p_link = proc->mp_timeout_next;
+            proc->mp_timeout_next = NULL;
+            return;
+        }
+        p_link = &(*p_link)->mp_timeout_next;
+    }
+}
+
+/* Make every process whose timed wait has expired ready. Run by the timer i-process */
+void k_expire_timeouts(void) {
+    while (gp_timeout_front != NULL && (int)(g_timer - gp_timeout_front->m_timeout) >= 0) {
+        PCB* proc = gp_timeout_front;
+        gp_timeout_front = proc->mp_timeout_next;
+        proc->mp_timeout_next = NULL;
+
+        if (proc->mp_queue != NULL) {
+            pq_pop_PCB(proc->mp_queue, proc);
+        }
+        proc->m_state = STATE_READY;
+        pq_push_ready(proc);
+    }
+}
+
+/**
+ * Count a miss for every EDF job still unfinished when g_timer passes its
+ * deadline, without waiting for the job to end. Run by the timer i-process.
+ *
+ * @param next time of the next timer event already known
+ * @return next, or the earliest deadline still ahead if that is sooner
+ */
+U32 k_check_deadlines(U32 next) {
+    while (gp_deadline_front != NULL && (int)(g_timer - gp_deadline_front->m_deadline) > 0) {
+        PCB* proc = gp_deadline_front;
+        gp_deadline_front = proc->mp_deadline_next;
+        proc->mp_deadline_next = NULL;
+
+        proc->m_deadline_missed = 1;
+        proc->m_deadline_misses++;
+        g_deadline_misses++;
+    }
+
+    if (gp_deadline_front != NULL && (int)(gp_deadline_front->m_deadline + 1 - next) < 0) {
+        next = gp_deadline_front->m_deadline + 1;
+    }
+    return next;
 }
 
-void k_set_uart_interrupt_pending() {
-    uart_i_proc_pending = 1;
+/**
+ * Preempt the current process once the kernel call or interrupt handler that
+ * made it lose its claim to the processor returns. The switch happens in
+ * PendSV, which has the lowest exception priority, so any number of requests
+ * before then cost a single pass through the scheduler. An interrupt process
+ * needs no request, since it goes through the scheduler when it finishes.
+ */
+void k_request_reschedule(void) {
+    if (gp_current_process != NULL && gp_current_process->m_priority == INTERRUPT) return;
+
+    g_reschedule_pending = 1;
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+/**
+ * Called by PendSV_Handler with interrupts disabled, and the registers the
+ * hardware does not stack already saved on the current process's stack.
+ */
+void c_PendSV_Handler(void) {
+    PCB* p_pcb_old = gp_current_process;
+
+    if (!g_reschedule_pending && !k_irq_pending()) return;
+
+    gp_current_process = scheduler();
+
+    if (gp_current_process == NULL) { // should never occur
+        gp_current_process = p_pcb_old; // revert back to the old process
+        return;
+    }
+
+    start_slice(gp_current_process);
+    process_switch(p_pcb_old);
+}
+
+/**
+ * Bind an interrupt to the interrupt process that services it. The handler of
+ * the interrupt calls k_defer_irq, and the process runs once the interrupt
+ * handlers are done. Raised interrupts are dispatched a round at a time: each
+ * runs once, highest priority first, before any of them runs again.
+ *
+ * @param irq the NVIC interrupt number
+ * @param pid an interrupt process
+ * @param priority dispatch priority, from 0 (first) to NUM_IRQ_SLOTS - 1.
+ *        No two interrupts share one
+ * @return 0 on success, -1 on error
+ */
+int k_bind_irq(int irq, int pid, int priority) {
+    if (irq < 0 || irq >= NUM_IRQS || g_irq_bit[irq] != 0) return RTX_ERR;
+    if (pid < 0 || pid >= NUM_PROCS || g_proc_table[pid].m_priority != INTERRUPT) return RTX_ERR;
+    if (priority < 0 || priority >= NUM_IRQ_SLOTS || (g_irq_bound & IRQ_BIT(priority))) return RTX_ERR;
+
+    g_irq_bound |= IRQ_BIT(priority);
+    g_irq_bit[irq] = IRQ_BIT(priority);
+    g_irq_slot_pid[priority] = pid;
+    g_irq_slot_irq[priority] = irq;
+
+    return RTX_OK;
+}
+
+/**
+ * Called by the handler of an interrupt bound by k_bind_irq. The interrupt
+ * stays off in the NVIC until its interrupt process has serviced it, so the
+ * peripheral need not be acknowledged in the handler.
+ */
+void k_defer_irq(int irq) {
+    NVIC_DisableIRQ((IRQn_Type) irq);
+    k_raise_irq(irq);
+}
+
+/**
+ * Dispatch the interrupt process bound to irq as if the interrupt had fired.
+ * Unlike NVIC_SetPendingIRQ this is not lost while the interrupt is masked.
+ */
+void k_raise_irq(int irq) {
+    U32 primask = __get_PRIMASK();
+
+    // interrupt processes get here with interrupts enabled, and a handler
+    // raising its own bit in between would be lost
+    __disable_irq();
+    g_irq_pending |= g_irq_bit[irq];
+    if (!primask) {
+        __enable_irq();
+    }
+
+    k_request_reschedule();
+}
+
+/* 1 if an interrupt process is waiting to be dispatched, 0 otherwise */
+int k_irq_pending(void) {
+    return (g_irq_pending | g_irq_batch) != 0;
+}
+
+/* The interrupt process to dispatch next, or NULL if none. The interrupts
+ * raised so far form a batch that drains before newer ones are looked at, so
+ * a busy interrupt cannot starve one of lower priority */
+PCB* next_irq_process(void) {
+    int slot;
+
+    if (g_irq_batch == 0) {
+        g_irq_batch = g_irq_pending;
+        g_irq_pending = 0;
+    }
+    if (g_irq_batch == 0) return NULL;
+
+    slot = __clz(g_irq_batch);
+    g_irq_batch &= ~IRQ_BIT(slot);
+    g_irq_current = slot;
+
+    return gp_pcbs[g_irq_slot_pid[slot]];
 }
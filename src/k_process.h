@@ -5,6 +5,30 @@
 
 /* Definitions */
 #define INITIAL_xPSR 0x01000000 // user process initial xPSR (Program Status Register) value
+#define NUM_MSG_REFS 16         // published messages queued beyond the first subscriber
+#define NUM_PID_WORDS ((NUM_PROCS + 31) / 32)
+#define DEFAULT_QUANTUM 20      // time slice in ms of each priority, see k_set_time_quantum
+#define NUM_IRQS 35             // external interrupts of the LPC17xx
+#define NUM_IRQ_SLOTS 32        // dispatch priorities of interrupt processes, see k_bind_irq
+#define IRQ_BIT(slot) (0x80000000u >> (slot))
+#define PID_BIT(pid) (0x80000000u >> ((pid) & 31)) // in word pid >> 5, see TOPIC
+
+/* Types */
+/* A topic and the processes subscribed to it, a bit per process id. The
+ * lowest process id of a word is its most significant bit, so the next
+ * subscriber is a count of leading zeros away */
+typedef struct topic {
+    char m_name[TOPIC_NAME_LEN]; // empty if the slot is free
+    U32 m_subscribers[NUM_PID_WORDS];
+    int m_num_subscribers;
+} TOPIC;
+
+/* Stands in for a published message on the queue of one subscriber. The copy
+ * of the header lets receive filters and priorities work as usual */
+typedef struct msg_ref {
+    MSG_BUF m_env;
+    MSG_BUF* mp_shared;          // the published message
+} MSG_REF;
 
 /* Functions */
 void process_init(void);
@@ -12,12 +36,44 @@ PCB* scheduler(void);
 int k_release_process(void);
 int k_set_process_priority(const int, const int);
 int k_get_process_priority(const int);
+int k_alloc_pid(void);
+void k_free_pid(int pid);
 int k_send_message(int process_id, void* p_msg_envelope);
+int k_try_send_message(int process_id, void* p_msg_envelope);
+int k_set_mailbox_capacity(int capacity);
+int k_forward_message(int process_id, void* p_msg_envelope);
+int k_send_batch(int process_id, void** p_msg_envelopes, int num_msgs);
+int k_send_message_priority(int process_id, void* p_msg_envelope, int priority);
+void* k_receive_message_timed(int* sender_id, int sender_pid, int mtype, int timeout);
 void* k_receive_message(int* sender_id);
+void* k_try_receive_message(int* sender_id);
+void* k_receive_message_timeout(int* sender_id, int timeout);
+void* k_receive_message_match(int sender_pid, int mtype);
 int k_delayed_send(int process_id, void* p_msg_envelope, int delay);
+int k_start_periodic(int process_id, void* p_msg_template, int period);
+void* k_cancel_delayed_send(int handle);
+int k_set_priority_inheritance(int enable);
+void* k_call(int process_id, void* p_msg_envelope);
+int k_reply(int process_id, void* p_msg_envelope);
+int k_subscribe(const char* topic);
+int k_unsubscribe(const char* topic);
+int k_publish(const char* topic, void* p_msg_envelope);
+int k_set_time_quantum(int priority, int quantum);
+int k_outranks(PCB* a, PCB* b);
+void k_request_reschedule(void);
+int k_bind_irq(int irq, int pid, int priority);
+void k_defer_irq(int irq);
+void k_raise_irq(int irq);
+int k_set_edf_period(int period);
+int k_wait_next_period(void);
+int k_create_process(void (*entry)(), int priority, int stack_size);
+int k_exit_process(void);
+void k_add_timeout(PCB* proc, U32 expiry);
+void k_remove_timeout(PCB* proc);
+void k_expire_timeouts(void);
+U32 k_check_deadlines(U32 next);
 
 extern U32* alloc_stack(U32 size_b); // allocate stack for a process
-extern void __rte(void);             // pop exception stack frame
 
 extern void set_test_procs(void);
 extern void set_sys_procs(void);
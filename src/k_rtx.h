@@ -9,4 +9,10 @@
     #define USR_SZ_STACK 0x100 // user proc stack size 128B
 #endif // DEBUG_0
 
+/* Kernel fields of a message envelope, kept in m_kdata */
+#define MSG_PREV(msg)     (*(MSG_BUF**)&(msg)->m_kdata[0]) // previous message in the timing wheel
+#define MSG_HANDLE(msg)   ((msg)->m_kdata[1])  // delayed send handle while pending, 0 otherwise
+#define MSG_PERIOD(msg)   ((msg)->m_kdata[2])  // period in ms of a start_periodic template, 0 otherwise
+#define MSG_PRIORITY(msg) ((msg)->m_kdata[3])  // message priority in [HIGH, LOWEST], decides the receive order
+
 #endif // K_RTX_H
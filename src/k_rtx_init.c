@@ -1,3 +1,4 @@
+#include <LPC17xx.h>
 #include "k_rtx_init.h"
 #include "uart.h"
 #include "k_memory.h"
@@ -21,8 +22,12 @@ void k_rtx_init(void) {
     /* Kernel */
     memory_init();
     process_init();
+    heap_init();
     timer_init(0);
 
+    // deferred context switches wait until every interrupt handler is done
+    NVIC_SetPriority(PendSV_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+
     __enable_irq();
 
     // start the first process
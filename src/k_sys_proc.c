@@ -12,14 +12,28 @@ extern int k_send_message(int, MSG_BUF*);
 extern int k_set_process_priority(const int, const int);
 extern int k_release_memory_block(void*);
 extern void* k_receive_message(int*);
+extern int k_send_message_internal(int, MSG_BUF*);
+extern U32 k_get_time(void);
+extern void k_timer_wakeup_at(U32);
 
 extern PROC_INIT g_proc_table[NUM_PROCS];
 
 // timer
 extern U32 g_timer;
 
-// delayed message send queue
-MSG_BUF* timeout_queue_front = NULL;
+/* Delayed messages are hashed by expiry time into a timing wheel: slot i holds
+ * the messages expiring at a time t with t % TIMER_WHEEL_SLOTS == i, so an
+ * insert is O(1) and each tick only looks at one slot */
+#define TIMER_WHEEL_SLOTS 128 // must be a power of 2
+
+/* A delayed send handle is the k_block_index of the message in its low bits and
+ * a sequence number above them, so a stale handle never matches a reused block */
+#define HANDLE_INDEX_BITS 10
+#define HANDLE_INDEX_MASK ((1 << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_SEQ_MASK   (0x1FFFFF)
+
+MSG_BUF* g_timer_wheel[TIMER_WHEEL_SLOTS];
+U32 g_handle_seq = 0;
 
 // command registery
 int g_KCD_REG[256];
@@ -32,7 +46,7 @@ void set_sys_procs() {
     /* null process */
     g_proc_table[PID_NULL].m_pid = PID_NULL;
     g_proc_table[PID_NULL].m_priority = HIDDEN;
-    g_proc_table[PID_NULL].m_stack_size = 0x100;
+    g_proc_table[PID_NULL].m_stack_size = 0x80;
     g_proc_table[PID_NULL].mpf_start_pc = &null_process;
 
     /* set priority process */
@@ -57,6 +71,8 @@ void set_sys_procs() {
 /* Null process */
 void null_process() {
     while (1) {
+        // nothing is ready, sleep until the next interrupt
+        __WFI();
         k_release_processor();
     }
 }
@@ -71,18 +87,20 @@ void set_priority_process(void) {
         int sender = 123;
         int proc_id = -1;
         int priority = -1;
+        int i = 3;
         msg = (MSG_BUF*) k_receive_message(&sender);
 
-        if (msg->mtext[2] == ' ' && (msg->mtext[4] == ' ' || msg->mtext[5] == ' ' )) {
-            if (msg->mtext[4] == ' ') {
-                // 1-digit PID
-                proc_id = msg->mtext[3] - '0';
-                priority = msg->mtext[5] - '0';
-            } else if (msg->mtext[5] == ' ') {
-                // 2-digit PID
-                proc_id = 10 * (msg->mtext[3] - '0') + (msg->mtext[4] - '0');
-                priority = msg->mtext[6] - '0';
+        // PIDs can have as many digits as NUM_PROCS needs
+        if (msg->mtext[2] == ' ') {
+            proc_id = 0;
+            while (msg->mtext[i] >= '0' && msg->mtext[i] <= '9') {
+                proc_id = 10 * proc_id + (msg->mtext[i] - '0');
+                i++;
             }
+        }
+
+        if (i > 3 && msg->mtext[i] == ' ') {
+            priority = msg->mtext[i + 1] - '0';
             if (k_set_process_priority(proc_id, priority) == RTX_ERR) {
                 logln("Error: invalid arguments for set_priority_process");
             }
@@ -173,46 +191,198 @@ void crt_process() {
 }
 
 /* Delayed messages */
-void insert_message_delayed(PCB* pcb, MSG_BUF* message, int delay) {
-    MSG_BUF* current = timeout_queue_front;
-    MSG_BUF* next;
 
-    int expiry = g_timer + delay;
-    message->m_expiry = expiry;
+/* Hang a message on the timing wheel slot of its m_expiry */
+void link_message_delayed(MSG_BUF* message) {
+    MSG_BUF** slot = &g_timer_wheel[message->m_expiry & (TIMER_WHEEL_SLOTS - 1)];
+
+    MSG_PREV(message) = NULL;
+    message->mp_next = *slot;
+    if (*slot != NULL) {
+        MSG_PREV(*slot) = message;
+    }
+    *slot = message;
+
+    k_timer_wakeup_at(message->m_expiry);
+}
+
+/* Take a message off its timing wheel slot */
+void unlink_message_delayed(MSG_BUF* message) {
+    MSG_BUF* prev = MSG_PREV(message);
+    MSG_BUF* next = (MSG_BUF*)message->mp_next;
 
-    if (current == NULL || current->m_expiry >= expiry) {
-        message->mp_next = current;
-        timeout_queue_front = message;
+    if (prev == NULL) {
+        g_timer_wheel[message->m_expiry & (TIMER_WHEEL_SLOTS - 1)] = next;
     } else {
-        next = current->mp_next;
-        while (next != NULL && next->m_expiry < expiry) {
-            current = next;
-            next = current->mp_next;
-        }
-        message->mp_next = current->mp_next;
-        current->mp_next = message;
+        prev->mp_next = next;
+    }
+
+    if (next != NULL) {
+        MSG_PREV(next) = prev;
     }
+
+    message->mp_next = NULL;
+    MSG_PREV(message) = NULL;
 }
 
+/**
+ * Put a message on the timing wheel.
+ *
+ * @return a handle for find_message_delayed, always greater than 0
+ */
+int insert_message_delayed(PCB* pcb, MSG_BUF* message, int delay) {
+    // 21 bits of sequence keep the handle positive, and 0 is never a handle
+    g_handle_seq = (g_handle_seq + 1) & HANDLE_SEQ_MASK;
+    if (g_handle_seq == 0) {
+        g_handle_seq = 1;
+    }
+
+    message->m_expiry = k_get_time() + delay;
+    MSG_HANDLE(message) = (g_handle_seq << HANDLE_INDEX_BITS) | k_block_index(message);
+    link_message_delayed(message);
+
+    return MSG_HANDLE(message);
+}
+
+/* Take a pending message off the timing wheel for good */
 void remove_message_delayed(MSG_BUF* message) {
-    MSG_BUF* current = timeout_queue_front;
-    MSG_BUF* previous;
-
-    while (current != NULL) {
-        if (current == message) {
-            if (current == timeout_queue_front) {
-                // found element at front
-                timeout_queue_front = NULL;
-                return;
+    unlink_message_delayed(message);
+    MSG_HANDLE(message) = 0;
+    MSG_PERIOD(message) = 0;
+}
+
+/**
+ * Find the pending message of a delayed send handle.
+ *
+ * @return the message, or NULL if the handle is not pending
+ */
+MSG_BUF* find_message_delayed(int handle) {
+    MSG_BUF* message;
+
+    if (handle <= 0) return NULL;
+
+    message = (MSG_BUF*)k_block_at(handle & HANDLE_INDEX_MASK);
+    if (message == NULL || MSG_HANDLE(message) != handle) return NULL;
+
+    return message;
+}
+
+/* 1 if a message is linked on the timing wheel, 0 otherwise. Only the first
+ * message of a slot has no MSG_PREV, and unlinking clears it */
+int message_on_wheel(MSG_BUF* message) {
+    return MSG_PREV(message) != NULL || g_timer_wheel[message->m_expiry & (TIMER_WHEEL_SLOTS - 1)] == message;
+}
+
+/**
+ * Deliver a periodic template itself. No block is allocated per tick: the
+ * template goes back on the wheel when its receiver releases it, see
+ * rearm_periodic_message.
+ */
+void send_periodic_message(MSG_BUF* message) {
+    unlink_message_delayed(message);
+    k_send_message_internal(message->m_recv_pid, message);
+}
+
+/**
+ * Put a periodic template released by its receiver back on the timing wheel
+ * at its next deadline, so the ticks never drift. No tick is lost while the
+ * receiver holds the template: one that came due meanwhile is delivered again
+ * right away, and the receiver catches up a tick per release.
+ *
+ * @return 1 if message is the template of a running periodic timer, which
+ *         stays allocated, 0 if it is to be freed
+ */
+int rearm_periodic_message(MSG_BUF* message) {
+    if (MSG_PERIOD(message) <= 0 || find_message_delayed(MSG_HANDLE(message)) != message) return 0;
+
+    // still pending, the release is a mistake and the kernel keeps the template
+    if (message_on_wheel(message)) return 1;
+
+    message->m_expiry += MSG_PERIOD(message);
+
+    // the wheel has already passed the slot of an overdue tick
+    if ((int)(g_timer - message->m_expiry) >= 0 && g_proc_table[message->m_recv_pid].m_pid != -1) {
+        k_send_message_internal(message->m_recv_pid, message);
+    } else {
+        link_message_delayed(message);
+    }
+
+    return 1;
+}
+
+/* Return every delayed or periodic message pending for process pid to the heap */
+void remove_messages_delayed_to(int pid) {
+    int i;
+
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        MSG_BUF* message = g_timer_wheel[i];
+
+        while (message != NULL) {
+            MSG_BUF* next = (MSG_BUF*)message->mp_next;
+
+            if (message->m_recv_pid == pid) {
+                remove_message_delayed(message);
+                k_release_memory_block(message);
+            }
+            message = next;
+        }
+    }
+}
+
+/* Send every delayed message in the slot of the current g_timer that is due */
+void send_expired_messages(void) {
+    MSG_BUF* message = g_timer_wheel[g_timer & (TIMER_WHEEL_SLOTS - 1)];
+
+    while (message != NULL) {
+        MSG_BUF* next = (MSG_BUF*)message->mp_next;
+
+        // messages more than one turn of the wheel away stay in the slot
+        if ((int)(g_timer - message->m_expiry) >= 0) {
+            if (g_proc_table[message->m_recv_pid].m_pid == -1) {
+                // the receiver exited while the message was pending
+                remove_message_delayed(message);
+                k_release_memory_block(message);
+            } else if (MSG_PERIOD(message) > 0) {
+                send_periodic_message(message);
             } else {
-                // found element, not at front
-                previous->mp_next = current->mp_next;
-                return;
+                remove_message_delayed(message);
+                k_send_message_internal(message->m_recv_pid, message);
             }
-        } else {
-            // didn't find element
-            previous = current;
-            current = current->mp_next;
         }
+
+        message = next;
+    }
+}
+
+/**
+ * Advance g_timer to now, sending the delayed messages due on the way. After a
+ * sleep longer than a turn of the wheel, visiting the last turn is enough.
+ */
+void advance_timer_wheel(U32 now) {
+    if (now - g_timer > TIMER_WHEEL_SLOTS) {
+        g_timer = now - TIMER_WHEEL_SLOTS;
+    }
+
+    while (g_timer != now) {
+        g_timer++;
+        send_expired_messages();
     }
 }
+
+/**
+ * @return the time of the earliest delayed message due within a turn of the
+ *         wheel, or a turn from now if there is none
+ */
+U32 next_message_expiry(void) {
+    U32 t;
+
+    for (t = g_timer + 1; t != g_timer + TIMER_WHEEL_SLOTS; t++) {
+        MSG_BUF* message = g_timer_wheel[t & (TIMER_WHEEL_SLOTS - 1)];
+
+        for (; message != NULL; message = message->mp_next) {
+            if ((int)(message->m_expiry - t) <= 0) return t;
+        }
+    }
+
+    return g_timer + TIMER_WHEEL_SLOTS;
+}
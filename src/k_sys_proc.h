@@ -1,10 +1,21 @@
 #ifndef SYS_PROC_H
 #define SYS_PROC_H
 
+#include "k_rtx.h"
+
 void set_sys_procs(void);
 void set_priority_process(void);
 void null_process(void);
 void kcd_process(void);
 void crt_process(void);
+void link_message_delayed(MSG_BUF* message);
+void unlink_message_delayed(MSG_BUF* message);
+int insert_message_delayed(PCB* pcb, MSG_BUF* message, int delay);
+void remove_message_delayed(MSG_BUF* message);
+MSG_BUF* find_message_delayed(int handle);
+void send_periodic_message(MSG_BUF* message);
+void send_expired_messages(void);
+void advance_timer_wheel(U32 now);
+U32 next_message_expiry(void);
 
 #endif // SYS_PROC_H
@@ -7,10 +7,10 @@
 
 #define BIT(X) (1 << X)
 
-extern int k_release_processor(void);
-extern void k_set_timer_interrupt_pending(void);
+extern void k_defer_irq(int irq);
+extern void k_raise_irq(int irq);
 
-volatile uint32_t g_timer = 0; // increments every 1 ms
+volatile uint32_t g_timer = 0; // time in ms the timer i-process has caught up to
 
 /**
  * @brief: initialize timer. Only timer 0 is supported
@@ -62,21 +62,24 @@ uint32_t timer_init(uint8_t n_timer) {
 
     /* Step 4.1: Prescale Register PR setting
        CCLK = 100 MHZ, PCLK = CCLK/4 = 25 MHZ
-       2*(12499 + 1)*(1/25) * 10^(-6) s = 10^(-3) s = 1 ms
-       TC (Timer Counter) toggles b/w 0 and 1 every 12500 PCLKs
-       see MR setting below
+       (24999 + 1)*(1/25) * 10^(-6) s = 10^(-3) s = 1 ms
+       TC (Timer Counter) increments every 25000 PCLKs, so it counts
+       milliseconds since timer_init
     */
-    pTimer->PR = 12499;
+    pTimer->PR = 24999;
 
-    /* Step 4.2: MR setting, see section 21.6.7 on pg496 of LPC17xx_UM. */
+    /* Step 4.2: MR setting, see section 21.6.7 on pg496 of LPC17xx_UM.
+       The timer is tickless: MR0 holds the next deadline, reprogrammed by
+       k_timer_wakeup_at, instead of matching every millisecond.
+    */
     pTimer->MR0 = 1;
 
     /* Step 4.3: MCR setting, see table 429 on pg496 of LPC17xx_UM.
        Interrupt on MR0: when MR0 mathches the value in the TC,
                          generate an interrupt.
-       Reset on MR0: Reset TC if MR0 mathches it.
+       TC is not reset on MR0, it keeps counting milliseconds.
     */
-    pTimer->MCR = BIT(0) | BIT(1);
+    pTimer->MCR = BIT(0);
 
     g_timer = 0;
 
@@ -90,23 +93,40 @@ uint32_t timer_init(uint8_t n_timer) {
 }
 
 /**
- * @brief: use CMSIS ISR for TIMER0 IRQ Handler
- * NOTE: This example shows how to save/restore all registers rather than just
- *       those backed up by the exception stack frame. We add extra
- *       push and pop instructions in the assembly routine.
- *       The actual c_TIMER0_IRQHandler does the rest of irq handling
+ * @brief: current time in ms, read from the free-running TIMER0 counter.
+ *         g_timer may lag behind it while no deadline is due
  */
-__asm void TIMER0_IRQHandler(void) {
-    PRESERVE8
-    IMPORT c_TIMER0_IRQHandler
-    CPSID I
-    PUSH{r4 - r11, lr}
-    BL c_TIMER0_IRQHandler
-    CPSIE I
-    POP{r4 - r11, pc}
+uint32_t k_get_time(void) {
+    return LPC_TIM0->TC;
 }
 
-void c_TIMER0_IRQHandler(void) {
-    k_set_timer_interrupt_pending();
-    k_release_processor();
+/**
+ * @brief: make sure TIMER0 interrupts no later than a given time. An earlier
+ *         deadline that is already programmed is kept
+ */
+void k_timer_wakeup_at(uint32_t time) {
+    uint32_t now = LPC_TIM0->TC;
+
+    if ((int)(time - now) <= 0) {
+        // already due, MR0 would not match until TC wraps around
+        k_raise_irq(TIMER0_IRQn);
+        return;
+    }
+
+    if ((int)(LPC_TIM0->MR0 - now) > 0 && (int)(LPC_TIM0->MR0 - time) <= 0) return;
+
+    LPC_TIM0->MR0 = time;
+
+    // TC may have passed the new match value while it was being written
+    if ((int)(LPC_TIM0->TC - time) >= 0) {
+        k_raise_irq(TIMER0_IRQn);
+    }
+}
+
+/**
+ * @brief: use CMSIS ISR for TIMER0 IRQ Handler
+ * The timer i-process acknowledges the match, see k_defer_irq
+ */
+void TIMER0_IRQHandler(void) {
+    k_defer_irq(TIMER0_IRQn);
 }
@@ -2,4 +2,6 @@
 #define _K_TIMER_H
 
 extern uint32_t timer_init(uint8_t n_timer); // initialize timer n_timer
+extern uint32_t k_get_time(void);            // current time in ms
+extern void k_timer_wakeup_at(uint32_t time); // interrupt no later than time
 #endif // _K_TIMER_H
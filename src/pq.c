@@ -1,21 +1,43 @@
 #include "pq.h"
 
+/* initialize an empty priority queue */
+void pq_init(PQ* pq) {
+    int i;
+    for (i = 0; i < NUM_PRIORITIES; i++) {
+        pq->front[i] = NULL;
+        pq->back[i] = NULL;
+    }
+    pq->bitmap = 0;
+}
+
 /* check if a given priority has no processes */
 int pq_is_priority_empty(const PQ* pq, const int priority) {
     /* return true if priority is out of bounds */
     if (priority < HIGH || priority > HIDDEN) return 1;
-    return pq->front[priority] == NULL;
+    return (pq->bitmap & PQ_BIT(priority)) == 0;
+}
+
+/* highest non-empty priority, or NUM_PRIORITIES if the queue is empty */
+int pq_top_priority(const PQ* pq) {
+    if (pq->bitmap == 0) return NUM_PRIORITIES;
+    return __clz(pq->bitmap);
 }
 
 /* push a given process onto the priority queue */
 void pq_push(PQ* pq, PCB* proc) {
     int priority = proc->m_priority;
+    proc->mp_next = NULL;
+    proc->mp_queue = pq;
+
     if (pq_is_priority_empty(pq, priority)) {
         /* if queue is empty, set both the front and back to proc */
+        proc->mp_prev = NULL;
         pq->front[priority] = proc;
         pq->back[priority] = proc;
+        pq->bitmap |= PQ_BIT(priority);
     } else {
         /* if queue is not empty, add proc to the back of the queue */
+        proc->mp_prev = pq->back[priority];
         pq->back[priority]->mp_next = proc;
         pq->back[priority] = proc;
     }
@@ -24,66 +46,80 @@ void pq_push(PQ* pq, PCB* proc) {
 /* push a given process onto the front of the priority queue */
 void pq_push_front(PQ* pq, PCB* proc) {
     int priority = proc->m_priority;
+    proc->mp_prev = NULL;
+    proc->mp_queue = pq;
+
     if (pq_is_priority_empty(pq, priority)) {
         /* if queue is empty, set both the front and back to proc */
+        proc->mp_next = NULL;
         pq->front[priority] = proc;
         pq->back[priority] = proc;
+        pq->bitmap |= PQ_BIT(priority);
     } else {
         /* if queue is not empty, add proc to the front of the queue */
         proc->mp_next = pq->front[priority];
+        pq->front[priority]->mp_prev = proc;
         pq->front[priority] = proc;
     }
 }
 
+/* push a given process in front of next, which is on the queue at the same
+ * priority. A NULL next pushes onto the back of the queue */
+void pq_push_before(PQ* pq, PCB* proc, PCB* next) {
+    if (next == NULL) {
+        pq_push(pq, proc);
+    } else if (next->mp_prev == NULL) {
+        pq_push_front(pq, proc);
+    } else {
+        proc->mp_queue = pq;
+        proc->mp_prev = next->mp_prev;
+        proc->mp_next = next;
+        next->mp_prev->mp_next = proc;
+        next->mp_prev = proc;
+    }
+}
+
 /* get the next process of a given priority. Only used internally */
 PCB* pq_pop_front(PQ* pq, const int priority) {
-    PCB* front_proc;
-
     /* if our queue is empty, return a NULL pointer */
     if (pq_is_priority_empty(pq, priority)) return NULL;
 
-    front_proc = pq->front[priority];
-    pq->front[priority] = front_proc->mp_next;
-
-    /* if queue only had 1 proc, it is now empty */
-    if (pq->front[priority] == NULL) pq->back[priority] = NULL;
-
-    front_proc->mp_next = NULL;
-    return front_proc;
+    return pq_pop_PCB(pq, pq->front[priority]);
 }
 
-/* pop a specific process */
-PCB* pq_pop_PCB(PQ* pq, const PCB* proc) {
-    PCB* found_proc;
-    PCB* temp_proc = pq->front[proc->m_priority];
+/* pop a specific process. The process links back to its neighbours, so this
+ * is a constant time unlink */
+PCB* pq_pop_PCB(PQ* pq, PCB* proc) {
+    int priority = proc->m_priority;
 
-    /* proc is at the front of the queue */
-    if (temp_proc == proc) return pq_pop_front(pq, proc->m_priority);
+    /* proc is not on this queue */
+    if (proc->mp_queue != pq) return NULL;
 
-    /* traverse our queue till we find proc */
-    while (temp_proc != NULL && temp_proc->mp_next != NULL && temp_proc->mp_next != proc) {
-        temp_proc = temp_proc->mp_next;
+    if (proc->mp_prev == NULL) {
+        pq->front[priority] = proc->mp_next;
+    } else {
+        proc->mp_prev->mp_next = proc->mp_next;
     }
 
-    /* proc does not exist */
-    if (temp_proc == NULL || temp_proc->mp_next == NULL) return NULL;
+    if (proc->mp_next == NULL) {
+        pq->back[priority] = proc->mp_prev;
+    } else {
+        proc->mp_next->mp_prev = proc->mp_prev;
+    }
+
+    /* if queue only had 1 proc, it is now empty */
+    if (pq->front[priority] == NULL) pq->bitmap &= ~PQ_BIT(priority);
 
-    /* remove and return temp_proc->mp_next */
-    found_proc = temp_proc->mp_next;
-    temp_proc->mp_next = found_proc->mp_next;
-    found_proc->mp_next = NULL;
-    return found_proc;
+    proc->mp_next = NULL;
+    proc->mp_prev = NULL;
+    proc->mp_queue = NULL;
+    return proc;
 }
 
-/* pop the first, highest-priority process */
+/* pop the first, highest-priority process. The highest non-empty priority is
+ * the number of leading zeros in the bitmap, a single CLZ instruction */
 PCB* pq_pop(PQ* pq) {
-    int priority;
-    PCB* proc = NULL;
-
-    for (priority = HIGH; priority <= HIDDEN; priority++) {
-        proc = pq->front[priority];
-        if (proc != NULL) return pq_pop_front(pq, priority);
-    }
+    if (pq->bitmap == 0) return NULL; // impossible - should return NULL process first
 
-    return NULL; // impossible - should return NULL process first
+    return pq_pop_front(pq, pq_top_priority(pq));
 }
@@ -3,16 +3,24 @@
 
 #include "k_rtx.h"
 
-typedef struct {
+/* Bit for a given priority in the PQ bitmap. HIGH maps to the most significant
+ * bit so that the highest non-empty priority is the count of leading zeros */
+#define PQ_BIT(priority) (0x80000000u >> (priority))
+
+typedef struct pq {
     PCB* front[NUM_PRIORITIES];
     PCB* back[NUM_PRIORITIES];
+    U32 bitmap;                  // bit PQ_BIT(p) is set iff priority p is non-empty
 } PQ;
 
+void pq_init(PQ* pq);
 int pq_is_priority_empty(const PQ* pq, const int priority);
+int pq_top_priority(const PQ* pq);
 void pq_push(PQ* pq, PCB* proc);
 void pq_push_front(PQ* pq, PCB* proc);
+void pq_push_before(PQ* pq, PCB* proc, PCB* next);
 PCB* pq_pop_front(PQ* pq, const int priority);
-PCB* pq_pop_PCB(PQ* pq, const PCB* proc);
+PCB* pq_pop_PCB(PQ* pq, PCB* proc);
 PCB* pq_pop(PQ* pq);
 
 #endif
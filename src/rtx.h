@@ -22,31 +22,131 @@ extern int k_get_process_priority(int process_id);
 #define get_process_priority(process_id) _get_process_priority((U32)k_get_process_priority, process_id)
 extern int _get_process_priority(U32 p_func, int process_id) __SVC_0;
 
+extern int k_create_process(void (*entry)(), int priority, int stack_size);
+#define create_process(entry, priority, stack_size) _create_process((U32)k_create_process, entry, priority, stack_size)
+extern int _create_process(U32 p_func, void (*entry)(), int priority, int stack_size) __SVC_0;
+
+extern int k_set_time_quantum(int priority, int quantum);
+#define set_time_quantum(priority, quantum) _set_time_quantum((U32)k_set_time_quantum, priority, quantum)
+extern int _set_time_quantum(U32 p_func, int priority, int quantum) __SVC_0;
+
+extern int k_exit_process(void);
+#define exit_process() _exit_process((U32)k_exit_process)
+extern int __SVC_0 _exit_process(U32 p_func);
+
 extern int k_set_process_priority(int process_id, int priority);
 #define set_process_priority(process_id, priority) _set_process_priority((U32)k_set_process_priority, process_id, priority)
 extern int _set_process_priority(U32 p_func, int process_id, int priority) __SVC_0;
 
+extern int k_set_edf_period(int period);
+#define set_edf_period(period) _set_edf_period((U32)k_set_edf_period, period)
+extern int _set_edf_period(U32 p_func, int period) __SVC_0;
+
+extern int k_wait_next_period(void);
+#define wait_next_period() _wait_next_period((U32)k_wait_next_period)
+extern int __SVC_0 _wait_next_period(U32 p_func);
+
+extern int k_set_priority_inheritance(int enable);
+#define set_priority_inheritance(enable) _set_priority_inheritance((U32)k_set_priority_inheritance, enable)
+extern int _set_priority_inheritance(U32 p_func, int enable) __SVC_0;
+
 /* Memory Management */
 extern void* k_request_memory_block(void);
 #define request_memory_block() _request_memory_block((U32)k_request_memory_block)
 extern void* _request_memory_block(U32 p_func) __SVC_0;
 
+extern void* k_try_request_memory_block(void);
+#define try_request_memory_block() _try_request_memory_block((U32)k_try_request_memory_block)
+extern void* _try_request_memory_block(U32 p_func) __SVC_0;
+
+extern void* k_request_memory_block_timeout(int timeout);
+#define request_memory_block_timeout(timeout) _request_memory_block_timeout((U32)k_request_memory_block_timeout, timeout)
+extern void* _request_memory_block_timeout(U32 p_func, int timeout) __SVC_0;
+
+extern void* k_request_memory_block_sized(int size_b);
+#define request_memory_block_sized(size_b) _request_memory_block_sized((U32)k_request_memory_block_sized, size_b)
+extern void* _request_memory_block_sized(U32 p_func, int size_b) __SVC_0;
+
 extern int k_release_memory_block(void* p_mem_blk);
 #define release_memory_block(p_mem_blk) _release_memory_block((U32)k_release_memory_block, p_mem_blk)
 extern int _release_memory_block(U32 p_func, void* p_mem_blk) __SVC_0;
 
+extern int k_release_memory_blocks(void** p_mem_blks, int num_blocks);
+#define release_memory_blocks(p_mem_blks, num_blocks) _release_memory_blocks((U32)k_release_memory_blocks, p_mem_blks, num_blocks)
+extern int _release_memory_blocks(U32 p_func, void** p_mem_blks, int num_blocks) __SVC_0;
+
 /* Inter-process Communication Management */
 extern int k_send_message(int, void*);
 #define send_message(process_id, p_msg_envelope) _send_message((U32)k_send_message, process_id, p_msg_envelope)
 extern int _send_message(U32 p_func, int process_id, void* p_msg_envelope) __SVC_0;
 
+extern int k_try_send_message(int process_id, void* p_msg_envelope);
+#define try_send_message(process_id, p_msg_envelope) _try_send_message((U32)k_try_send_message, process_id, p_msg_envelope)
+extern int _try_send_message(U32 p_func, int process_id, void* p_msg_envelope) __SVC_0;
+
+extern int k_set_mailbox_capacity(int capacity);
+#define set_mailbox_capacity(capacity) _set_mailbox_capacity((U32)k_set_mailbox_capacity, capacity)
+extern int _set_mailbox_capacity(U32 p_func, int capacity) __SVC_0;
+
+extern int k_forward_message(int process_id, void* p_msg_envelope);
+#define forward_message(process_id, p_msg_envelope) _forward_message((U32)k_forward_message, process_id, p_msg_envelope)
+extern int _forward_message(U32 p_func, int process_id, void* p_msg_envelope) __SVC_0;
+
+extern int k_send_batch(int process_id, void** p_msg_envelopes, int num_msgs);
+#define send_batch(process_id, p_msg_envelopes, num_msgs) _send_batch((U32)k_send_batch, process_id, p_msg_envelopes, num_msgs)
+extern int _send_batch(U32 p_func, int process_id, void** p_msg_envelopes, int num_msgs) __SVC_0;
+
+extern int k_subscribe(const char* topic);
+#define subscribe(topic) _subscribe((U32)k_subscribe, topic)
+extern int _subscribe(U32 p_func, const char* topic) __SVC_0;
+
+extern int k_unsubscribe(const char* topic);
+#define unsubscribe(topic) _unsubscribe((U32)k_unsubscribe, topic)
+extern int _unsubscribe(U32 p_func, const char* topic) __SVC_0;
+
+extern int k_publish(const char* topic, void* p_msg_envelope);
+#define publish(topic, p_msg_envelope) _publish((U32)k_publish, topic, p_msg_envelope)
+extern int _publish(U32 p_func, const char* topic, void* p_msg_envelope) __SVC_0;
+
+extern int k_send_message_priority(int process_id, void* p_msg_envelope, int priority);
+#define send_message_priority(process_id, p_msg_envelope, priority) _send_message_priority((U32)k_send_message_priority, process_id, p_msg_envelope, priority)
+extern int _send_message_priority(U32 p_func, int process_id, void* p_msg_envelope, int priority) __SVC_0;
+
 extern void* k_receive_message(int* sender_id);
 #define receive_message(sender_id) _receive_message((U32)k_receive_message, sender_id)
 extern void* _receive_message(U32 p_func, int* sender_id) __SVC_0;
 
+extern void* k_try_receive_message(int* sender_id);
+#define try_receive_message(sender_id) _try_receive_message((U32)k_try_receive_message, sender_id)
+extern void* _try_receive_message(U32 p_func, int* sender_id) __SVC_0;
+
+extern void* k_receive_message_timeout(int* sender_id, int timeout);
+#define receive_message_timeout(sender_id, timeout) _receive_message_timeout((U32)k_receive_message_timeout, sender_id, timeout)
+extern void* _receive_message_timeout(U32 p_func, int* sender_id, int timeout) __SVC_0;
+
+extern void* k_receive_message_match(int sender_pid, int mtype);
+#define receive_message_match(sender_pid, mtype) _receive_message_match((U32)k_receive_message_match, sender_pid, mtype)
+extern void* _receive_message_match(U32 p_func, int sender_pid, int mtype) __SVC_0;
+
+extern void* k_call(int process_id, void* p_msg_envelope);
+#define call(process_id, p_msg_envelope) _call((U32)k_call, process_id, p_msg_envelope)
+extern void* _call(U32 p_func, int process_id, void* p_msg_envelope) __SVC_0;
+
+extern int k_reply(int process_id, void* p_msg_envelope);
+#define reply(process_id, p_msg_envelope) _reply((U32)k_reply, process_id, p_msg_envelope)
+extern int _reply(U32 p_func, int process_id, void* p_msg_envelope) __SVC_0;
+
 /* Timing Service */
 extern int k_delayed_send(int process_id, void* p_msg_envelope, int delay);
 #define delayed_send(process_id, p_msg_envelope, delay) _delayed_send((U32)k_delayed_send, process_id, p_msg_envelope, delay)
 extern int _delayed_send(U32 p_func, int process_id, void* p_msg_envelope, int delay) __SVC_0;
 
+extern int k_start_periodic(int process_id, void* p_msg_template, int period);
+#define start_periodic(process_id, p_msg_template, period) _start_periodic((U32)k_start_periodic, process_id, p_msg_template, period)
+extern int _start_periodic(U32 p_func, int process_id, void* p_msg_template, int period) __SVC_0;
+
+extern void* k_cancel_delayed_send(int handle);
+#define cancel_delayed_send(handle) _cancel_delayed_send((U32)k_cancel_delayed_send, handle)
+extern void* _cancel_delayed_send(U32 p_func, int handle) __SVC_0;
+
 #endif // RTX_H
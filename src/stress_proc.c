@@ -49,7 +49,7 @@ void procA() {
     while (1) {
         MSG_BUF* msg = (MSG_BUF*) request_memory_block();
         msg->mtype = COUNT_REPORT;
-        msg->m_kdata[0] = num;
+        *(int*)msg->mtext = num; // m_kdata belongs to the kernel
         send_message(PID_B, msg);
         num++;
 
@@ -60,33 +60,25 @@ void procA() {
 void procB() {
     MSG_BUF* msg;
 
+    set_mailbox_capacity(STRESS_MAILBOX_CAPACITY);
+
     while (1) {
         msg = (MSG_BUF*) receive_message(NULL);
-        send_message(PID_C, msg);
+        forward_message(PID_C, msg);
     }
 }
 
 void procC() {
-    MSG_BUF* front = NULL;
-    MSG_BUF* back = NULL;
     MSG_BUF* p;
     MSG_BUF* q;
 
+    set_mailbox_capacity(STRESS_MAILBOX_CAPACITY);
+
     while (1) {
-        if (front == NULL) {
-            p = receive_message(NULL);
-        } else {
-            // dequeue p from the local queue
-            p = front;
-            front = front->mp_next;
-            if (front == NULL) {
-                back = NULL;
-            }
-            p->mp_next = NULL;
-        }
+        p = receive_message(NULL);
 
         if (p->mtype == COUNT_REPORT) {
-            if (p->m_kdata[0] % 20 == 0) {
+            if (*(int*)p->mtext % 20 == 0) {
                 p->mtext[0] = 'P';
                 p->mtext[1] = 'r';
                 p->mtext[2] = 'o';
@@ -107,21 +99,8 @@ void procC() {
                 q->mtype = WAKEUP_10;
                 delayed_send(PID_C, q, ONE_SECOND * 10);
 
-                while (1) {
-                    p = receive_message(NULL);
-                    if (p->mtype == WAKEUP_10) {
-                        break;
-                    } else {
-                        // push p to the local queue
-                        if (front == NULL) {
-                            front = p;
-                            back = p;
-                        } else {
-                            back->mp_next = p;
-                            back = p;
-                        }
-                    }
-                }
+                // reports that arrive meanwhile stay queued in the kernel
+                p = receive_message_match(PID_C, WAKEUP_10);
             }
         }
 
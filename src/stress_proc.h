@@ -1,6 +1,8 @@
 #ifndef STRESS_PROC_H
 #define STRESS_PROC_H
 
+#define STRESS_MAILBOX_CAPACITY 4 // reports procB and procC hold before procA blocks
+
 void set_stress_procs(void);
 
 void procA(void);
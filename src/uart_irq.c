@@ -6,8 +6,7 @@
     #include "printf.h"
 #endif
 
-extern int k_release_processor(void);
-extern void k_set_uart_interrupt_pending(void);
+extern void k_defer_irq(int irq);
 
 /**
  * @brief: initialize the n_uart
@@ -143,25 +142,8 @@ int uart_irq_init(int n_uart) {
 
 /**
  * @brief: use CMSIS ISR for UART0 IRQ Handler
- * NOTE: This example shows how to save/restore all registers rather than just
- *       those backed up by the exception stack frame. We add extra
- *       push and pop instructions in the assembly routine.
- *       The actual c_UART0_IRQHandler does the rest of irq handling
+ * The uart i-process reads IIR to acknowledge the interrupt, see k_defer_irq
  */
-__asm void UART0_IRQHandler(void) {
-    PRESERVE8
-    IMPORT c_UART0_IRQHandler
-    CPSID I
-    PUSH{r4 - r11, lr}
-    BL c_UART0_IRQHandler
-    CPSIE I
-    POP{r4 - r11, pc}
-}
-
-/**
- * @brief: c UART0 IRQ Handler
- */
-void c_UART0_IRQHandler(void) {
-    k_set_uart_interrupt_pending();
-    k_release_processor();
+void UART0_IRQHandler(void) {
+    k_defer_irq(UART0_IRQn);
 }
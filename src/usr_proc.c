@@ -10,6 +10,10 @@
 //#define MESSAGE_TESTS
 #define KCD_CRT_TESTS
 //#define SET_PROC_PRIORITY_TESTS
+//#define PROCESS_TESTS
+//#define RPC_TESTS
+//#define PUBSUB_TESTS
+//#define EDF_TESTS
 
 extern PROC_INIT g_proc_table[];
 PROC_INIT g_test_procs[NUM_TEST_PROCS];
@@ -57,10 +61,23 @@ void wall_clock_print(int clock) {
     send_message(PID_CRT, msg);
 }
 
+/* Stop the periodic tick, if any. A tick the clock was already sent is freed
+ * once it is received and released */
+void wall_clock_stop(int ticker) {
+    MSG_BUF* template;
+
+    if (ticker == 0) return;
+
+    template = (MSG_BUF*) cancel_delayed_send(ticker);
+    if (template != NULL) {
+        release_memory_block(template);
+    }
+}
+
 void wall_clock_process() {
     int clock;
-    int running = 0;
-    char version = 0;
+    int ticker = 0;        // handle of the periodic tick, 0 if the clock is stopped
+    MSG_BUF* tick = NULL;  // its template, which is also every tick message
     MSG_BUF* command = request_memory_block();
 
     command->mtype = KCD_REG;
@@ -75,10 +92,9 @@ void wall_clock_process() {
         case PID_KCD:
             if (command->mtext[2] == 'R') {
                 clock = 0;
-                running = 1;
-                version++;
-                command->mtext[0] = version;
-                delayed_send(PID_CLOCK, command, ONE_SECOND);
+                wall_clock_stop(ticker);
+                ticker = start_periodic(PID_CLOCK, command, ONE_SECOND);
+                tick = command;
                 wall_clock_print(clock);
             } else if (command->mtext[2] == 'S'
                        && command->mtext[3] == ' '
@@ -89,27 +105,27 @@ void wall_clock_process() {
                 int seconds = ctoi(command->mtext[10]) * 10 + ctoi(command->mtext[11]);
                 clock = 3600 * hours + 60 * minutes + seconds;
                 clock %= 24 * 60 * 60;
-                running = 1;
-                version++;
-                command->mtext[0] = version;
-                delayed_send(PID_CLOCK, command, ONE_SECOND);
+                wall_clock_stop(ticker);
+                ticker = start_periodic(PID_CLOCK, command, ONE_SECOND);
+                tick = command;
                 wall_clock_print(clock);
             } else if (command->mtext[2] == 'T') {
-                running = 0;
+                wall_clock_stop(ticker);
+                ticker = 0;
+                tick = NULL;
                 release_memory_block(command);
             } else {
                 release_memory_block(command);
             }
             break;
         case PID_CLOCK:
-            if (running) {
+            // a tick of a timer stopped after it was sent is dropped
+            if (command == tick) {
                 clock++;
                 clock %= 24 * 60 * 60;
-                delayed_send(PID_CLOCK, command, ONE_SECOND);
                 wall_clock_print(clock);
-            } else {
-                release_memory_block(command);
             }
+            release_memory_block(command);
             break;
         }
 
@@ -631,3 +647,489 @@ void proc5(void) { while (1) { logln("Process 5"); release_processor(); } }
 void proc6(void) { while (1) { logln("Process 6"); release_processor(); } }
 
 #endif
+
+#ifdef PROCESS_TESTS
+
+#define NUM_SPAWNS 1000
+
+int g_children_run;
+
+/**
+ * @brief: short-lived process that exits as soon as it runs
+ */
+void child_proc(void) {
+    g_children_run++;
+    exit_process();
+}
+
+/**
+ * @brief: tests create_process and exit_process, and benchmarks a spawn and
+ *         teardown round trip
+ */
+void proc1(void) {
+    int i;
+    int pid;
+    int numTests = 3;
+    U32 start;
+    U32 elapsed;
+
+    set_process_priority(1, MEDIUM);
+
+    logln("G021_test: START");
+    logln("G021_test: total %d tests", numTests);
+
+    /* test 1: a higher priority child runs and exits before create_process returns */
+    g_children_run = 0;
+    pid = create_process(&child_proc, HIGH, 0x100);
+    if (pid >= NUM_FIXED_PROCS && pid < NUM_PROCS && g_children_run == 1) {
+        logln("G021_test: test 1 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 1 FAIL");
+    }
+
+    /* test 2: invalid priorities are rejected */
+    if (create_process(&child_proc, HIDDEN, 0x100) == RTX_ERR) {
+        logln("G021_test: test 2 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 2 FAIL");
+    }
+
+    /* test 3: stacks and PIDs are recycled, so spawning never runs out */
+    g_children_run = 0;
+    start = LPC_TIM0->TC; // TIMER0 counts milliseconds
+    for (i = 0; i < NUM_SPAWNS; i++) {
+        if (create_process(&child_proc, HIGH, 0x100) == RTX_ERR) break;
+    }
+    elapsed = LPC_TIM0->TC - start;
+
+    if (i == NUM_SPAWNS && g_children_run == NUM_SPAWNS) {
+        logln("G021_test: test 3 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 3 FAIL");
+    }
+    logln("G021_test: %d spawn/exit round trips in %d ms", i, elapsed);
+
+    logln("G021_test: %d/%d tests OK", g_tests_passed, numTests);
+    logln("G021_test: %d/%d tests FAIL", (numTests - g_tests_passed), numTests);
+    logln("G021_test: END");
+
+    while (1) {
+        release_processor();
+    }
+}
+
+void proc2(void) { while (1) { release_processor(); } }
+void proc3(void) { while (1) { release_processor(); } }
+void proc4(void) { while (1) { release_processor(); } }
+void proc5(void) { while (1) { release_processor(); } }
+void proc6(void) { while (1) { release_processor(); } }
+
+#endif
+
+#ifdef RPC_TESTS
+
+#define NUM_CALLS 1000
+#define RPC_SEND 1 // mtype of a request the server answers with send_message
+
+/**
+ * @brief: benchmarks call/reply against a send_message/receive_message round
+ *         trip to the server in proc2
+ */
+void proc1(void) {
+    int i;
+    int numTests = 3;
+    U32 start;
+    U32 call_ms;
+    U32 send_ms;
+    MSG_BUF* msg;
+
+    set_process_priority(1, MEDIUM);
+
+    logln("G021_test: START");
+    logln("G021_test: total %d tests", numTests);
+
+    /* test 1: call returns the server's reply */
+    msg = (MSG_BUF*) request_memory_block();
+    msg->mtype = DEFAULT;
+    msg->mtext[0] = 1;
+    msg = (MSG_BUF*) call(2, msg);
+    if (msg != NULL && msg->mtext[0] == 2) {
+        logln("G021_test: test 1 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 1 FAIL");
+    }
+
+    /* test 2: calling an unused process id fails */
+    if (call(NUM_PROCS - 1, msg) == NULL) {
+        logln("G021_test: test 2 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 2 FAIL");
+    }
+
+    /* test 3: round trip latency */
+    start = LPC_TIM0->TC; // TIMER0 counts milliseconds
+    for (i = 0; i < NUM_CALLS && msg != NULL; i++) {
+        msg = (MSG_BUF*) call(2, msg);
+    }
+    call_ms = LPC_TIM0->TC - start;
+
+    msg->mtype = RPC_SEND;
+    start = LPC_TIM0->TC;
+    for (i = 0; i < NUM_CALLS && msg != NULL; i++) {
+        send_message(2, msg);
+        msg = (MSG_BUF*) receive_message(NULL);
+    }
+    send_ms = LPC_TIM0->TC - start;
+
+    if (msg != NULL) {
+        logln("G021_test: test 3 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 3 FAIL");
+    }
+    logln("G021_test: %d call/reply round trips in %d ms", NUM_CALLS, call_ms);
+    logln("G021_test: %d send/receive round trips in %d ms", NUM_CALLS, send_ms);
+
+    logln("G021_test: %d/%d tests OK", g_tests_passed, numTests);
+    logln("G021_test: %d/%d tests FAIL", (numTests - g_tests_passed), numTests);
+    logln("G021_test: END");
+
+    while (1) {
+        release_processor();
+    }
+}
+
+/**
+ * @brief: server that increments mtext[0] and answers each request the way
+ *         it was asked
+ */
+void proc2(void) {
+    int sender;
+    MSG_BUF* msg;
+
+    set_process_priority(2, MEDIUM);
+
+    while (1) {
+        msg = (MSG_BUF*) receive_message(&sender);
+        msg->mtext[0]++;
+
+        if (msg->mtype == RPC_SEND) {
+            send_message(sender, msg);
+        } else {
+            reply(sender, msg);
+        }
+    }
+}
+
+void proc3(void) { while (1) { release_processor(); } }
+void proc4(void) { while (1) { release_processor(); } }
+void proc5(void) { while (1) { release_processor(); } }
+void proc6(void) { while (1) { release_processor(); } }
+
+#endif
+
+#ifdef PUBSUB_TESTS
+
+#define MAX_PUBLISHES 64 // gives up on exhausting the queue entries past this
+#define PUBSUB_RELEASE 1 // mtype of a command to release the published message
+#define PUBSUB_LEAVE 2   // same, then unsubscribe
+
+MSG_BUF* g_got2; // last message published to proc2
+MSG_BUF* g_got3; // last message published to proc3
+
+/**
+ * @brief: subscribes to "news" and holds on to the last published message
+ *         until proc1 tells it to release it
+ */
+void subscriber(MSG_BUF** got) {
+    int command;
+    MSG_BUF* msg;
+    MSG_BUF* held = NULL;
+
+    subscribe("news");
+
+    while (1) {
+        msg = (MSG_BUF*) receive_message(NULL);
+        if (msg->mtype == DEFAULT) {
+            held = msg;
+            *got = msg;
+            continue;
+        }
+
+        // the command block first, so the published one ends up on top of the free list
+        command = msg->mtype;
+        release_memory_block(msg);
+        release_memory_block(held);
+        held = NULL;
+
+        if (command == PUBSUB_LEAVE) {
+            unsubscribe("news");
+        }
+    }
+}
+
+/**
+ * @brief: tells a subscriber to let go of the published message it holds
+ */
+void send_command(int pid, int command) {
+    MSG_BUF* msg = (MSG_BUF*) request_memory_block();
+    msg->mtype = command;
+    send_message(pid, msg);
+}
+
+/**
+ * @brief: runs the publish/subscribe tests against the subscribers in
+ *         proc2-proc4
+ */
+void proc1(void) {
+    int i;
+    int result;
+    int numTests = 7;
+    MSG_BUF* msg;
+    MSG_BUF* other;
+
+    set_process_priority(1, MEDIUM);
+    set_process_priority(2, HIGH);
+    set_process_priority(3, HIGH);
+    set_process_priority(4, HIGH);
+
+    logln("G021_test: START");
+    logln("G021_test: total %d tests", numTests);
+
+    /* test 1: topics nobody subscribed to are rejected */
+    msg = (MSG_BUF*) request_memory_block();
+    msg->mtype = DEFAULT;
+    if (publish("none", msg) == RTX_ERR && unsubscribe("none") == RTX_ERR) {
+        logln("G021_test: test 1 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 1 FAIL");
+    }
+
+    /* test 2: every subscriber gets the same block */
+    if (publish("news", msg) == RTX_OK && g_got2 == msg && g_got3 == msg) {
+        logln("G021_test: test 2 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 2 FAIL");
+    }
+
+    /* test 3: a block the subscribers share cannot be sent on */
+    if (send_message(5, msg) == RTX_ERR && publish("news", msg) == RTX_ERR) {
+        logln("G021_test: test 3 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 3 FAIL");
+    }
+
+    /* test 4: the block only goes back to the heap with its last holder */
+    send_command(2, PUBSUB_RELEASE);
+    other = (MSG_BUF*) request_memory_block();
+    result = other != msg;
+    release_memory_block(other);
+
+    send_command(3, PUBSUB_LEAVE);
+    other = (MSG_BUF*) request_memory_block();
+    if (result && other == msg) {
+        logln("G021_test: test 4 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 4 FAIL");
+    }
+
+    /* test 5: an unsubscribed process gets nothing */
+    other->mtype = DEFAULT;
+    if (publish("news", other) == RTX_OK && g_got2 == other && g_got3 == msg) {
+        logln("G021_test: test 5 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 5 FAIL");
+    }
+    send_command(2, PUBSUB_LEAVE);
+
+    /* test 6: publishing fails once the spare queue entries run out, proc4 is
+       too low to take its messages off them */
+    subscribe("full");
+    result = RTX_OK;
+    for (i = 0; i < MAX_PUBLISHES && result == RTX_OK; i++) {
+        msg = (MSG_BUF*) try_request_memory_block();
+        if (msg == NULL) break;
+        msg->mtype = DEFAULT;
+        result = publish("full", msg);
+    }
+    if (result == RTX_ERR && release_memory_block(msg) == RTX_OK) {
+        logln("G021_test: test 6 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 6 FAIL");
+        if (msg != NULL) release_memory_block(msg);
+    }
+
+    /* test 7: the entries come back as the subscribers receive */
+    set_process_priority(4, HIGH);
+    while ((msg = (MSG_BUF*) try_receive_message(NULL)) != NULL) {
+        release_memory_block(msg);
+    }
+    msg = (MSG_BUF*) request_memory_block();
+    msg->mtype = DEFAULT;
+    if (publish("full", msg) == RTX_OK) {
+        logln("G021_test: test 7 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 7 FAIL");
+    }
+    release_memory_block(receive_message(NULL));
+    unsubscribe("full");
+
+    logln("G021_test: %d/%d tests OK", g_tests_passed, numTests);
+    logln("G021_test: %d/%d tests FAIL", (numTests - g_tests_passed), numTests);
+    logln("G021_test: END");
+
+    while (1) {
+        release_processor();
+    }
+}
+
+void proc2(void) { subscriber(&g_got2); }
+void proc3(void) { subscriber(&g_got3); }
+
+/**
+ * @brief: subscribes to "full", then drops below proc1 until test 7 raises
+ *         it again to drain its queue
+ */
+void proc4(void) {
+    subscribe("full");
+    set_process_priority(4, LOWEST);
+
+    while (1) {
+        release_memory_block(receive_message(NULL));
+    }
+}
+
+void proc5(void) { while (1) { release_processor(); } }
+void proc6(void) { while (1) { release_processor(); } }
+
+#endif
+
+#ifdef EDF_TESTS
+
+extern U32 g_deadline_misses;
+
+int g_ran2;      // 1 once proc2 ran
+int g_order[2];  // pids of the EDF jobs in the order they ran
+int g_num_ran;
+
+/**
+ * @brief: runs the EDF tests
+ */
+void proc1(void) {
+    int numTests = 4;
+    int result;
+    U32 start;
+    U32 misses;
+    MSG_BUF* msg;
+
+    set_process_priority(1, MEDIUM);
+
+    logln("G021_test: START");
+    logln("G021_test: total %d tests", numTests);
+
+    /* test 1: invalid periods and static processes are rejected */
+    if (set_edf_period(-1) == RTX_ERR && wait_next_period() == RTX_ERR) {
+        logln("G021_test: test 1 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 1 FAIL");
+    }
+
+    /* test 2: an EDF process runs ahead of the highest static priority */
+    set_edf_period(1000);
+    set_process_priority(2, HIGH);
+    result = g_ran2 == 0;
+    set_edf_period(0);
+    if (result && g_ran2 == 1) {
+        logln("G021_test: test 2 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 2 FAIL");
+    }
+
+    /* test 3: the earliest deadline runs first, whatever the wake up order */
+    set_process_priority(3, HIGH); // period 200
+    set_process_priority(4, HIGH); // period 100
+    set_edf_period(50);
+    msg = (MSG_BUF*) request_memory_block();
+    send_message(3, msg);
+    msg = (MSG_BUF*) request_memory_block();
+    send_message(4, msg);
+    wait_next_period();
+    set_edf_period(0);
+    if (g_num_ran == 2 && g_order[0] == 4 && g_order[1] == 3) {
+        logln("G021_test: test 3 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 3 FAIL");
+    }
+
+    /* test 4: a miss counts once its deadline passes, not when the job ends */
+    misses = g_deadline_misses;
+    start = LPC_TIM0->TC; // TIMER0 counts milliseconds
+    set_edf_period(10);
+    while (LPC_TIM0->TC - start < 30) {
+        // overrun the job by 20 ms
+    }
+    result = g_deadline_misses == misses + 1;
+    wait_next_period();
+    set_edf_period(0);
+    if (result && g_deadline_misses == misses + 1) {
+        logln("G021_test: test 4 OK");
+        g_tests_passed++;
+    } else {
+        logln("G021_test: test 4 FAIL");
+    }
+
+    logln("G021_test: %d/%d tests OK", g_tests_passed, numTests);
+    logln("G021_test: %d/%d tests FAIL", (numTests - g_tests_passed), numTests);
+    logln("G021_test: END");
+
+    while (1) {
+        release_processor();
+    }
+}
+
+void proc2(void) {
+    g_ran2 = 1;
+    while (1) {
+        release_memory_block(receive_message(NULL));
+    }
+}
+
+/**
+ * @brief: becomes an EDF process and logs when its job gets the message
+ *         from proc1
+ */
+void edf_job(int pid, int period) {
+    MSG_BUF* msg;
+
+    set_edf_period(period);
+    msg = (MSG_BUF*) receive_message(NULL);
+    g_order[g_num_ran++] = pid;
+    release_memory_block(msg);
+    set_edf_period(0);
+
+    while (1) {
+        release_memory_block(receive_message(NULL));
+    }
+}
+
+void proc3(void) { edf_job(3, 200); }
+void proc4(void) { edf_job(4, 100); }
+void proc5(void) { while (1) { release_processor(); } }
+void proc6(void) { while (1) { release_processor(); } }
+
+#endif
@@ -0,0 +1,24 @@
+/* @brief: host.h lets the hardware independent kernel sources build with a
+ *         host compiler, for the benchmarks in this directory.
+ *         Included ahead of every source by the Makefile
+ */
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#undef NULL // common.h defines its own
+
+/* armcc intrinsic, never called with 0 */
+#define __clz(x) __builtin_clz(x)
+
+/* monotonic time in nanoseconds */
+static inline long long host_now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+#endif // HOST_H
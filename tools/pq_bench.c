@@ -0,0 +1,43 @@
+/* @brief: pq_bench.c host microbenchmark of pq_push/pq_pop. Every pick of
+ *         the next process is a single CLZ on the priority bitmap, so the
+ *         cost per pop and push must not depend on which priority level the
+ *         processes are at
+ */
+#include "../src/pq.h"
+
+#define NUM_ROUNDS 10000000
+
+PCB g_pcbs[NUM_PROCS];
+
+/* ns per pq_pop + pq_push round trip with every process at a priority in
+ * [lowest, highest] */
+double bench(int highest, int lowest) {
+    PQ pq;
+    PCB* proc;
+    long long start;
+    int i;
+
+    pq_init(&pq);
+    for (i = 0; i < NUM_PROCS; i++) {
+        g_pcbs[i].m_pid = i;
+        g_pcbs[i].m_priority = highest + i % (lowest - highest + 1);
+        pq_push(&pq, &g_pcbs[i]);
+    }
+
+    start = host_now_ns();
+    for (i = 0; i < NUM_ROUNDS; i++) {
+        proc = pq_pop(&pq);
+        pq_push(&pq, proc);
+    }
+
+    return (double)(host_now_ns() - start) / NUM_ROUNDS;
+}
+
+int main(void) {
+    printf("pq_pop + pq_push, %d processes, %d rounds\n", NUM_PROCS, NUM_ROUNDS);
+    printf("  all at HIGH       %6.2f ns\n", bench(HIGH, HIGH));
+    printf("  all at LOWEST     %6.2f ns\n", bench(LOWEST, LOWEST));
+    printf("  all at HIDDEN     %6.2f ns\n", bench(HIDDEN, HIDDEN));
+    printf("  HIGH to HIDDEN    %6.2f ns\n", bench(HIGH, HIDDEN));
+    return 0;
+}
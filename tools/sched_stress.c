@@ -0,0 +1,44 @@
+/* @brief: sched_stress.c host stress test of the scheduling path at a given
+ *         process table size, built once per NUM_PROCS by the Makefile.
+ *         Every process is alive, and each tick preempts the running process
+ *         or blocks it and wakes another one, the way scheduler() and the
+ *         blocking kernel calls use the queues. The cost per tick must not
+ *         grow with NUM_PROCS
+ */
+#include "../src/pq.h"
+
+#define NUM_TICKS 10000000
+
+PCB g_pcbs[NUM_PROCS];
+PQ g_ready_pq;
+PQ g_blocked_pq;
+
+int main(void) {
+    PCB* proc;
+    long long start;
+    int i;
+
+    pq_init(&g_ready_pq);
+    pq_init(&g_blocked_pq);
+    for (i = 0; i < NUM_PROCS; i++) {
+        g_pcbs[i].m_pid = i;
+        g_pcbs[i].m_priority = MEDIUM + i % 3;
+        pq_push(&g_ready_pq, &g_pcbs[i]);
+    }
+
+    start = host_now_ns();
+    for (i = 0; i < NUM_TICKS; i++) {
+        proc = pq_pop(&g_ready_pq);
+
+        if (i % 4 == 0) {
+            // the process blocks, and the one blocked longest is woken
+            pq_push(&g_blocked_pq, proc);
+            proc = pq_pop_PCB(&g_blocked_pq, g_blocked_pq.front[pq_top_priority(&g_blocked_pq)]);
+        }
+        pq_push(&g_ready_pq, proc);
+    }
+
+    printf("NUM_PROCS %3d: %6.2f ns per tick\n", NUM_PROCS,
+           (double)(host_now_ns() - start) / NUM_TICKS);
+    return 0;
+}